@@ -0,0 +1,156 @@
+#ifndef ACCELERATOR_H
+#define ACCELERATOR_H
+
+#include "basicTypeDefinition.h"
+#include "PrimitiveBlock.h"
+#include "RayPacket.h"
+#include <string>
+#include <vector>
+
+class Ray;
+class ThreadPool;
+
+class AABB
+{
+public:
+    Vec3f min, max;
+    AABB() : min(INFINITY, INFINITY, INFINITY), max(-INFINITY, -INFINITY, -INFINITY) {}
+    AABB(Vec3f min, Vec3f max) : min(min), max(max) {}
+    void expand(const Vec3f &p)
+    {
+        min = Vec3f(fminf(min.x, p.x), fminf(min.y, p.y), fminf(min.z, p.z));
+        max = Vec3f(fmaxf(max.x, p.x), fmaxf(max.y, p.y), fmaxf(max.z, p.z));
+    }
+    void expand(const AABB &box)
+    {
+        expand(box.min);
+        expand(box.max);
+    }
+    AABB intersection(const AABB &box) const
+    {
+        return AABB(Vec3f(fmaxf(min.x, box.min.x), fmaxf(min.y, box.min.y), fmaxf(min.z, box.min.z)),
+                    Vec3f(fminf(max.x, box.max.x), fminf(max.y, box.max.y), fminf(max.z, box.max.z)));
+    }
+    Vec3f centroid() const {return (min + max) * 0.5f;}
+    float surfaceArea() const
+    {
+        Vec3f d = max - min;
+        if (d.x < 0 or d.y < 0 or d.z < 0) return 0;
+        return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+    // 30 bit morton code of a point quantized to 1024 steps along each axis of the box, x in the highest bit of each triple
+    unsigned int mortonCode(const Vec3f &p) const;
+    // slab test against a ray given by its origin and reciprocal direction, returns the entry distance or INFINITY on a miss
+    float intersect(const Vec3f &origin, const Vec3f &inv_direction, float t_max) const;
+    // same test that also reports the exit distance
+    bool intersect(const Vec3f &origin, const Vec3f &inv_direction, float t_max, float &t_near, float &t_far) const;
+    // the slab test for four rays at once, set lanes are the rays that hit the box
+    Mask4 intersect(const Vec3f4 &origin, const Vec3f4 &inv_direction, const Float4 &t_max) const;
+};
+
+// immutable intersection data of a face, precomputed once so that ray tests do no vertex lookups, square roots or writes
+struct TriangleRecord
+{
+    Vec3f v0;
+    Vec3f edge1; // v1 - v0
+    Vec3f edge2; // v2 - v0
+    Vec3f normal;
+    int material_id;
+};
+
+struct SphereRecord
+{
+    Vec3f center;
+    float radius_squared;
+    int material_id;
+};
+
+struct TraversalStats
+{
+    unsigned long long rays; // all queries, the next three split them by what the ray is used for
+    unsigned long long primary_rays;
+    unsigned long long shadow_rays;
+    unsigned long long reflection_rays;
+    unsigned long long hits; // closest hit queries that found a primitive and shadow rays that were blocked
+    unsigned long long nodes_visited;
+    unsigned long long triangle_tests;
+    unsigned long long sphere_tests;
+    TraversalStats() : rays(0), primary_rays(0), shadow_rays(0), reflection_rays(0), hits(0), nodes_visited(0), triangle_tests(0), sphere_tests(0) {}
+    unsigned long long primitiveTests() const {return triangle_tests + sphere_tests;}
+    void add(const TraversalStats &stats)
+    {
+        rays += stats.rays;
+        primary_rays += stats.primary_rays;
+        shadow_rays += stats.shadow_rays;
+        reflection_rays += stats.reflection_rays;
+        hits += stats.hits;
+        nodes_visited += stats.nodes_visited;
+        triangle_tests += stats.triangle_tests;
+        sphere_tests += stats.sphere_tests;
+    }
+};
+
+// how a hierarchy is constructed, structures without these choices ignore them
+struct BuildOptions
+{
+    std::string builder; // "sah" for binned surface area heuristic splits or "lbvh" for morton code splits
+    bool treelets;       // refines the hierarchy by restructuring small treelets for a lower SAH cost
+    ThreadPool *pool;    // workers for the parallel parts of the build, NULL builds on the calling thread
+    BuildOptions() : builder("sah"), treelets(false), pool(NULL) {}
+};
+
+// common interface of the acceleration structures, primitive ids [0, spheres.size()) are spheres and the rest are faces
+class Accelerator
+{
+public:
+    Accelerator() {}
+    virtual ~Accelerator() {}
+    // returns a new acceleration structure of the given type ("bvh", "bvh4", "bvh8" or "kdtree")
+    static Accelerator *create(const std::string &type, const BuildOptions &options);
+
+    virtual void build(vector<Sphere> &spheres, vector<Face> &faces, const Background &background) = 0;
+    // finds the closest primitive hit by the ray with t below t_max, returns -1 and sets t to t_max if there is none
+    virtual int intersect(const Vec3f &origin, const Vec3f &direction, float &t, float t_max = INFINITY) const = 0;
+    // stops at the first primitive hit with t in (0, t_max), used for shadow rays
+    virtual bool occluded(const Vec3f &origin, const Vec3f &direction, float t_max) const = 0;
+    // closest hits of all active rays of a packet, structures without packet traversal trace the rays one by one
+    virtual void intersectPacket(const RayPacket &packet, PacketHit &hit) const;
+    // material and world space normal at a point on a primitive that was hit
+    virtual void surfaceAt(int primitive, const Vec3f &point, Vec3f &normal, int &material_id) const;
+    virtual void printBuildStats() const = 0;
+
+    int primitiveCount() const {return sphere_records.size() + triangles.size();}
+    bool isSphere(int primitive) const {return primitive < (int)sphere_records.size();}
+    const SphereRecord &getSphere(int primitive) const {return sphere_records[primitive];}
+    const TriangleRecord &getTriangle(int primitive) const {return triangles[primitive - sphere_records.size()];}
+
+    // traversal counters are accumulated per thread in slots of their own cache lines and merged once no thread is tracing
+    static TraversalStats &threadStats();
+    static void mergeThreadStats();
+    // seconds is the render time that the rays per second refer to
+    static void printTraversalStats(double seconds);
+    // counters merged since the last reset
+    static TraversalStats totalStats();
+    static void resetStats();
+
+protected:
+    vector<SphereRecord> sphere_records;
+    vector<TriangleRecord> triangles; // contiguous in primitive id order
+
+    // converts the scene objects into intersection records, called first by every build
+    void precomputePrimitives(vector<Sphere> &spheres, vector<Face> &faces, const Background &background);
+    // appends the primitives as blocks of up to width lanes, triangles and spheres go to separate blocks
+    void appendBlocks(const int *primitives, int count, int width, vector<PrimitiveBlock> &blocks) const;
+    // world space bounds of every primitive, indexed by primitive id
+    void computePrimitiveBounds(vector<AABB> &bounds) const;
+    float intersectPrimitive(const Vec3f &origin, const Vec3f &direction, int primitive) const;
+    // the same test for the rays of a packet group, only the lanes in active are counted as primitive tests
+    Float4 intersectPrimitive(const Vec3f4 &origin, const Vec3f4 &direction, int primitive, int active) const;
+    // keeps the closer of two hits, exact ties (shared edges) go to the lower id to match the order of a linear scan
+    static bool closerHit(float t_primitive, int primitive, float t, int hit)
+    {
+        return t_primitive > 0 and (t_primitive < t or (t_primitive == t and primitive < hit));
+    }
+};
+
+#endif
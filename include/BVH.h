@@ -0,0 +1,47 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "Accelerator.h"
+#include "BVHBuilder.h"
+#include <vector>
+
+struct BVHNode // 32 bytes, children of an interior node are stored at (this + 1) and at offset
+{
+    AABB bounds;
+    int offset;           // first primitive block of a leaf, index of the second child for an interior node
+    unsigned short count; // number of primitive blocks, 0 for interior nodes
+    unsigned short axis;  // split axis of an interior node, used to order the traversal front to back
+};
+
+class BVH : public Accelerator
+{
+public:
+    explicit BVH(const BuildOptions &options) : build_options(options), kernels(NULL), max_leaf_size(4), build_time_ms(0), max_depth(0), leaf_count(0), sah_cost(0) {}
+    // builds the hierarchy over all spheres and faces of the scene with the builder chosen in the options
+    void build(vector<Sphere> &spheres, vector<Face> &faces, const Background &background);
+    int intersect(const Vec3f &origin, const Vec3f &direction, float &t, float t_max = INFINITY) const;
+    bool occluded(const Vec3f &origin, const Vec3f &direction, float t_max) const;
+    // visits every node that any ray of the packet hits once for the whole packet
+    void intersectPacket(const RayPacket &packet, PacketHit &hit) const;
+    void printBuildStats() const;
+
+protected:
+    BuildOptions build_options;
+    vector<BVHNode> nodes;
+    vector<PrimitiveBlock> blocks; // the primitives of every leaf, in leaf order
+    vector<int> primitive_ids;     // only used while building
+    const BlockKernels *kernels;
+    int max_leaf_size;             // the block width, so that a leaf is tested in one go
+
+    double build_time_ms;
+    int max_depth;
+    int leaf_count;
+    float sah_cost;
+
+    // copies the built tree in depth first order, so that the first child of every interior node follows it
+    int flatten(const vector<BuildNode> &build_nodes, int node, int depth);
+    // "sah" or "lbvh", followed by " + treelets" when they were optimized
+    std::string builderName() const;
+};
+
+#endif
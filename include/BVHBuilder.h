@@ -0,0 +1,74 @@
+#ifndef BVH_BUILDER_H
+#define BVH_BUILDER_H
+
+#include "Accelerator.h"
+#include <functional>
+#include <vector>
+
+#define TRAVERSAL_COST 1.0f
+#define INTERSECTION_COST 1.0f
+
+class ThreadPool;
+
+// node of a hierarchy under construction, children are referenced explicitly so that treelets can be rearranged
+struct BuildNode
+{
+    AABB bounds;
+    int left, right; // child nodes, -1 for a leaf
+    int begin, count; // range of a leaf in primitive_ids
+    int axis;         // split axis of an interior node
+};
+
+// constructs a binary hierarchy over primitive bounds, large ranges are split on the calling thread and the
+// subtrees below them are built by the workers of the pool
+class BVHBuilder
+{
+public:
+    // pool may be NULL, then everything is built on the calling thread
+    BVHBuilder(const vector<AABB> &bounds, int max_leaf_size, int max_depth, ThreadPool *pool);
+    // binned surface area heuristic splits
+    void buildSAH();
+    // splits at the highest differing bit of the morton codes of the primitive centroids
+    void buildLBVH();
+    // replaces small treelets by the topology with the lowest SAH cost, unless the tree would get deeper than max_depth
+    void optimizeTreelets();
+
+    vector<BuildNode> nodes; // the root is nodes[0]
+    vector<int> primitive_ids;
+
+private:
+    const vector<AABB> &bounds;
+    vector<Vec3f> centroids;
+    vector<unsigned int> morton_codes; // code of primitive_ids[i], only used by buildLBVH
+    int max_leaf_size;
+    int max_depth;
+    ThreadPool *pool;
+    bool lbvh;
+    // roots of the subtrees that were built as separate tasks
+    vector<int> task_roots;
+
+    struct Task
+    {
+        int node, begin, end, depth;
+    };
+
+    void build();
+    // builds the node for [begin, end) into out, ranges with at most task_size primitives are deferred to tasks
+    int buildRecursive(vector<BuildNode> &out, int begin, int end, int depth, int task_size, vector<Task> *tasks);
+    // chooses the split of [begin, end) and reorders primitive_ids, returns false if the range becomes a leaf
+    bool split(int begin, int end, const AABB &centroid_bounds, const AABB &node_bounds, bool parallel, int &mid, int &axis);
+    bool splitSAH(int begin, int end, const AABB &centroid_bounds, const AABB &node_bounds, bool parallel, int &mid, int &axis);
+    bool splitMorton(int begin, int end, int &mid, int &axis);
+    void sortByMortonCode();
+
+    float optimizeTreelets(int node, vector<float> &cost);
+    float optimizeTreelet(int root, vector<float> &cost);
+    int depth(int node) const;
+
+    // number of chunks that parallelFor splits a range of count primitives into
+    int chunkCount(int count) const;
+    // calls body(chunk, begin, end) for the chunks of [0, count), on the pool if the range is large enough to be worth it
+    void parallelFor(int count, const std::function<void(int, int, int)> &body, bool parallel = true) const;
+};
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include "RenderOptions.h"
+#include <string>
+
+// renders every scene file in the directory the given number of times without writing images and
+// reports parse, build and render times, ray throughput and peak memory as JSON
+void runBenchmark(const RenderOptions &options, const std::string &directory, int repeats, const std::string &json_path);
+
+#endif
@@ -4,8 +4,11 @@
 #include "basicTypeDefinition.h"
 #include "ppm.h"
 #include "Ray.h"
+#include "RenderOptions.h"
 #include <string>
-#include <thread>
+#include <vector>
+
+#define HEATMAP_COUNT 4 // costs per pixel: nodes visited, primitive tests, shadow rays and reflection depth
 
 using namespace std;
 class Camera
@@ -14,11 +17,28 @@ public:
     Camera();
     Camera(Vec3f position, Vec3f gaze, Vec3f up, Vec4f near_plane, float near_distance, int image_width, int image_height, std::string image_name);
     ~Camera();
-    void rayTrace(vector<Sphere> &spheres, vector<Face> &faces, Background &background);
-    void saveImage();
-    void computeTracingRays();
+    // the image is rendered in square tiles that can be traced independently by any thread
+    int tileCount() const;
+    // options.trace chooses how the rays are traced, options.sampling how the samples of a pixel are placed.
+    // Only every stride-th pixel in both directions is traced and fills its stride x stride block, refine skips the pixels
+    // that the previous pass at twice the stride has traced
+    void renderTile(int tile, Accelerator &accelerator, const Background &background, const RenderOptions &options, int stride = 1,
+                    bool refine = false);
+    // tone maps the framebuffer into the ppm file, a ppm format given in the scene file for this camera takes precedence over
+    // options.ppm_format. The unmapped framebuffer also goes into a pfm file of the same name if options.write_pfm is set
+    // With heatmaps enabled, the costs are written as false color images <image>_nodes, _primitives, _shadow and _depth
+    void saveImage(const RenderOptions &options);
+    // counts the work of every pixel from now on, its rays are then traced one by one whatever the trace mode
+    void enableHeatmaps();
+    void setPpmFormat(const std::string &ppm_format) {this->ppm_format = ppm_format;}
+    // samples per pixel, jittered inside a grid of strata when there is more than one
+    void setNumSamples(int num_samples) {this->num_samples = num_samples;}
+    // primary ray through the point (dx, dy) of pixel (x, y) in pixel units, by default its center, row 0 is the top of the image
+    Ray generateRay(int x, int y, float dx = 0.5f, float dy = 0.5f) const;
 
 private:
+    friend class Scene; // the scene cache stores the camera settings as they were given in the scene file
+
     Vec3f position;                // this is the origin of the camera in the world coordinate system (x,y,z)
     Vec3f gaze;                    // this is the gaze direction of the camera (-w)
     Vec3f up;                      // this is the up vector of the camera (v)
@@ -26,8 +46,31 @@ private:
     float near_distance;           // this is the distance between the camera and the near plane (d)
     int image_width, image_height; // this is the width and height of the image that will be produced by the camera (nx,ny)
     std::string image_name;
-    unsigned char *imageData = nullptr;
-    Ray *tracingRays = nullptr;    // this is the array of rays that will be used to trace the scene from the camera (r)
+    std::string ppm_format;        // empty unless the camera asks for a specific ppm format
+    int num_samples;               // primary rays per pixel, the adaptive mode may use fewer
+    float *framebuffer = nullptr;  // linear colors of the pixels row by row, 255 is white before tone mapping
+    float *heatmaps = nullptr;     // HEATMAP_COUNT costs per pixel averaged over its samples, only allocated by enableHeatmaps
+
+    // precomputed for generateRay
+    Vec3f u, v;                    // camera basis, w is the opposite of the gaze
+    Vec3f q;                       // corner of the near plane at (l, b) as given in the scene file
+    float plane_width, plane_height;
+
+    // a primary ray position, (dx, dy) is the offset from the pixel's corner in pixel units
+    struct PixelSample
+    {
+        int x, y;
+        float dx, dy;
+    };
+
+    void computeBasis();
+    // appends samples [first, first + count) of every pixel of the tile that is selected, the same sample of all pixels of a
+    // packet sized block one after the other so that packets get neighbouring pixels
+    void addSamples(int x0, int y0, int x1, int y1, const std::vector<unsigned char> &selected, int first, int count,
+                    std::vector<PixelSample> &samples) const;
+    // colors of the samples' primary rays, and HEATMAP_COUNT costs per sample unless costs is NULL
+    void traceSamples(const std::vector<PixelSample> &samples, Accelerator &accelerator, const Background &background,
+                      const std::string &trace, std::vector<Vec3f> &colors, std::vector<float> *costs) const;
 };
 
 #endif
\ No newline at end of file
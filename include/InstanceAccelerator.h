@@ -0,0 +1,57 @@
+#ifndef INSTANCE_ACCELERATOR_H
+#define INSTANCE_ACCELERATOR_H
+
+#include "Accelerator.h"
+#include "BVHBuilder.h"
+#include "Transform.h"
+#include <string>
+#include <vector>
+
+// two level structure: every instanced mesh has its own structure in object space, rays are transformed into it when
+// they enter one of the mesh's instances. The geometry that is not instanced keeps its own structure and primitive ids.
+class InstanceAccelerator : public Accelerator
+{
+public:
+    // type and options are used for the structure of the plain geometry and for every mesh
+    InstanceAccelerator(const std::string &type, const BuildOptions &options);
+    ~InstanceAccelerator();
+    // geometry that is stored once, returns the index for addInstance
+    int addMesh(const vector<Face> &faces);
+    // places a mesh in the scene with its own material
+    void addInstance(int mesh, const Transform &object_to_world, int material_id);
+    // builds the structures of the plain geometry and of the meshes, then the top level over the instance bounds
+    void build(vector<Sphere> &spheres, vector<Face> &faces, const Background &background);
+    // instance primitives are numbered after the plain ones, instance by instance
+    int intersect(const Vec3f &origin, const Vec3f &direction, float &t, float t_max = INFINITY) const;
+    bool occluded(const Vec3f &origin, const Vec3f &direction, float t_max) const;
+    void surfaceAt(int primitive, const Vec3f &point, Vec3f &normal, int &material_id) const;
+    void printBuildStats() const;
+
+private:
+    struct Instance
+    {
+        Transform to_world;
+        Transform to_object;
+        bool identity; // rays enter without a transformation
+        AABB bounds;   // world space
+        int mesh;
+        int material_id;
+        int first_primitive; // id of the instance's first triangle
+    };
+
+    std::string type;
+    BuildOptions options;
+    Accelerator *plain; // spheres and faces that are not instanced
+    vector<vector<Face> > mesh_faces; // only kept until the build
+    vector<Accelerator *> meshes;
+    vector<int> mesh_triangles;
+    vector<Instance> instances;    // in the order they were added, so first_primitive is increasing
+    vector<BuildNode> top_nodes;
+    vector<int> top_instances;     // instances of the top level leaves
+    int plain_primitives;
+    double build_time_ms;
+
+    int findInstance(int primitive) const;
+};
+
+#endif
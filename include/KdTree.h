@@ -0,0 +1,60 @@
+#ifndef KD_TREE_H
+#define KD_TREE_H
+
+#include "Accelerator.h"
+#include <vector>
+
+struct KdNode // 8 bytes, the child below the split plane is stored right after its parent
+{
+    union {
+        float split;          // split position of an interior node
+        int primitive_offset; // first index into primitive_indices for a leaf
+    };
+    int flags; // lower 2 bits are the split axis or 3 for a leaf, upper bits the primitive count of a leaf or the index of the above child
+
+    bool isLeaf() const {return (flags & 3) == 3;}
+    int axis() const {return flags & 3;}
+    int primitiveCount() const {return flags >> 2;}
+    int aboveChild() const {return flags >> 2;}
+};
+
+struct KdEvent
+{
+    float position;
+    int primitive;
+    bool start;
+    bool operator<(const KdEvent &e) const
+    {
+        if (position == e.position) return start and !e.start;
+        return position < e.position;
+    }
+};
+
+class KdTree : public Accelerator
+{
+public:
+    KdTree() : build_time_ms(0), depth_limit(0), max_depth(0), leaf_count(0), empty_leaf_count(0) {}
+    // builds the tree with surface area heuristic splits evaluated on the primitives clipped to each node
+    void build(vector<Sphere> &spheres, vector<Face> &faces, const Background &background);
+    int intersect(const Vec3f &origin, const Vec3f &direction, float &t, float t_max = INFINITY) const;
+    bool occluded(const Vec3f &origin, const Vec3f &direction, float t_max) const;
+    void printBuildStats() const;
+
+private:
+    AABB bounds;
+    vector<KdNode> nodes;
+    vector<int> primitive_indices;
+
+    double build_time_ms;
+    int depth_limit;
+    int max_depth;
+    int leaf_count;
+    int empty_leaf_count;
+
+    void buildRecursive(vector<AABB> &primitive_bounds, const AABB &node_bounds, vector<int> &primitives, int depth, int bad_refines);
+    void makeLeaf(int node_index, vector<int> &primitives);
+    // tight bounds of the part of a primitive that lies inside the node, empty if they do not overlap
+    AABB clipPrimitive(vector<AABB> &primitive_bounds, int primitive, const AABB &node_bounds) const;
+};
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef LANE_MATH_H
+#define LANE_MATH_H
+
+// ray tests written once for any float lane type F (Float4, or the AVX2 lanes of the block kernels) that provides
+// the arithmetic and comparison operators, select, abs and sqrt. Lane by lane they perform exactly the float
+// operations of Ray::calculateFaceIntersection and Ray::calculateSphereIntersection, so every width gives the
+// same distances as a single ray. Only templates live here, the AVX2 kernels include this file with AVX2 enabled.
+
+// float thresholds that select exactly the floats below the double constants of the single ray face test
+extern const float face_determinant_epsilon;
+extern const float face_min_distance;
+
+// one vector per lane
+template <class F>
+class Vec3Lanes
+{
+public:
+    F x, y, z;
+    Vec3Lanes() {}
+    Vec3Lanes(const F &x, const F &y, const F &z) : x(x), y(y), z(z) {}
+    const F &operator[](int axis) const {return axis == 0 ? x : (axis == 1 ? y : z);}
+    Vec3Lanes operator-(const Vec3Lanes &v) const {return Vec3Lanes(x - v.x, y - v.y, z - v.z);}
+    // same operation order as Vec3f::dot and Vec3f::cross
+    F dot(const Vec3Lanes &v) const {return x * v.x + y * v.y + z * v.z;}
+    Vec3Lanes cross(const Vec3Lanes &v) const {return Vec3Lanes(y * v.z - z * v.y, z * v.x - x * v.z, x * v.y - y * v.x);}
+};
+
+// distance to the triangle or -1 for a miss in every lane
+template <class F>
+F faceIntersectionLanes(const Vec3Lanes<F> &origin, const Vec3Lanes<F> &direction, const Vec3Lanes<F> &v0, const Vec3Lanes<F> &edge1,
+                        const Vec3Lanes<F> &edge2)
+{
+    Vec3Lanes<F> h = direction.cross(edge2);
+    F determinantA = edge1.dot(h);
+    auto hit = abs(determinantA) >= F(face_determinant_epsilon);
+    // 1.0 / determinantA in double rounds to the same float as the float division
+    F f = F(1.0f) / determinantA;
+    Vec3Lanes<F> s = origin - v0;
+    F u = f * s.dot(h);
+    hit = hit & (u >= F(0.0f)) & (u <= F(1.0f));
+    Vec3Lanes<F> q = s.cross(edge1);
+    F v = f * direction.dot(q);
+    hit = hit & (v >= F(0.0f)) & (u + v <= F(1.0f));
+    F t = f * edge2.dot(q);
+    hit = hit & (t >= F(face_min_distance));
+    return select(hit, t, F(-1.0f));
+}
+
+// distance to the sphere or -1 for a miss in every lane
+template <class F>
+F sphereIntersectionLanes(const Vec3Lanes<F> &origin, const Vec3Lanes<F> &direction, const Vec3Lanes<F> &center, const F &radius_squared)
+{
+    Vec3Lanes<F> offset = origin - center;
+    F a = direction.dot(direction);
+    F b = direction.dot(offset);
+    F c = offset.dot(offset) - radius_squared;
+    F discriminant = b*b - a*c;
+    auto hit = discriminant >= F(0.0f);
+    F root = sqrt(discriminant);
+    F t1 = (-b - root) / a;
+    F t2 = (-b + root) / a;
+    F t = select(t2 >= F(0.0f), t2, F(-1.0f));
+    t = select((t1 >= F(0.0f)) & (t1 < t2), t1, t);
+    return select(hit, t, F(-1.0f));
+}
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef PRIMITIVE_BLOCK_H
+#define PRIMITIVE_BLOCK_H
+
+#include <string>
+
+#define BLOCK_SIZE 8
+
+// up to BLOCK_SIZE triangles or spheres of a leaf stored component by component, so that one ray is tested against all of them at once
+struct alignas(16) PrimitiveBlock
+{
+    float rows[9][BLOCK_SIZE];  // triangles: v0, edge1 and edge2 by component, spheres: center by component and radius squared
+    int primitive[BLOCK_SIZE];  // ids of the primitives in the lanes
+    int count;                  // lanes in use, the others are zero
+    int is_sphere;
+};
+
+// tests of one ray against a whole block, the kernels of the processor are picked at run time
+struct BlockKernels
+{
+    const char *name;
+    int width; // lanes tested at once, the BVH makes its leaves this large
+    // updates t and hit when a lane is closer, exact ties go to the lower id like Accelerator::closerHit
+    void (*intersect)(const PrimitiveBlock &block, const float *origin, const float *direction, float &t, int &hit);
+    bool (*occluded)(const PrimitiveBlock &block, const float *origin, const float *direction, float t_max);
+};
+
+// "auto" takes AVX2 when the processor supports it, "avx2" and "sse" force a kernel set, throws if it is not available
+void selectBlockKernels(const std::string &name);
+const BlockKernels &blockKernels();
+
+// the AVX2 kernels, compiled separately with AVX2 enabled and only called after the processor has been checked
+void intersectBlockAvx2(const PrimitiveBlock &block, const float *origin, const float *direction, float &t, int &hit);
+bool occludedBlockAvx2(const PrimitiveBlock &block, const float *origin, const float *direction, float t_max);
+// slab test of a ray against the eight child boxes of a BVH8 node, stored as rows of min x, y, z and max x, y, z.
+// Returns a bit per box that is hit and stores the entry distances
+int intersectBoxesAvx2(const float (*bounds)[8], const float *origin, const float *inv_direction, float t_max, float *t_near);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <chrono>
+#include <string>
+
+// scoped wall clock timers that are collected per thread and exported as a Chrome trace (chrome://tracing or Perfetto).
+// Timers cost a single branch until the profiler is enabled, nested scopes show up as nested slices of their thread
+class Profiler
+{
+public:
+    // starts collecting, times in the trace are relative to this call
+    static void enable();
+    static bool isEnabled() {return enabled;}
+    // writes all events collected so far as trace event JSON
+    static void write(const std::string &filename);
+    // name must be a string literal, the event keeps the pointer
+    static void record(const char *name, const char *arg_name, int arg, std::chrono::steady_clock::time_point start,
+                       std::chrono::steady_clock::time_point end);
+
+private:
+    static bool enabled;
+};
+
+class ScopedTimer
+{
+public:
+    // arg_name and arg label the slice in the trace, for example the tile a thread renders
+    explicit ScopedTimer(const char *name, const char *arg_name = NULL, int arg = 0) : name(name), arg_name(arg_name), arg(arg)
+    {
+        if (Profiler::isEnabled()) start = std::chrono::steady_clock::now();
+    }
+    ~ScopedTimer()
+    {
+        if (Profiler::isEnabled()) Profiler::record(name, arg_name, arg, start, std::chrono::steady_clock::now());
+    }
+
+private:
+    const char *name;
+    const char *arg_name;
+    int arg;
+    std::chrono::steady_clock::time_point start;
+};
+
+#endif
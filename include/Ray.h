@@ -2,6 +2,7 @@
 #define RAY_BETTER_H
 
 #include "basicTypeDefinition.h"
+#include "Accelerator.h"
 #include <iostream>
 
 class Ray
@@ -18,12 +19,34 @@ public:
     ~Ray() {}
     Vec3f getDirection() {return direction;}
     Vec3f getOrigin() {return origin;}
-    bool closestIntersection(vector<Sphere> &spheres, vector<Face> &faces, Background &background);
-    float calculateSphereIntersection(Sphere &sphere, Background &background);
-    float calculateFaceIntersection(Face &face, Background &background);
-    bool isInShadow (const PointLight &light, vector<Sphere> &spheres, vector<Face> &faces, Background &background); 
-    Vec3f computeColor(vector<Sphere> &spheres, vector<Face> &faces, Background &background);
-    Vec3f applyShading(vector<Sphere> &spheres, vector<Face> &faces, Background &background); 
+    bool closestIntersection(Accelerator &accelerator, const Background &background);
+    // fills the hit record from a closest hit, false if primitive is -1
+    bool recordHit(int primitive, float t, Accelerator &accelerator, const Background &background);
+    // any-hit query for shadow rays, true if something is hit with t in (0, t_max)
+    static bool occluded(const Vec3f &origin, const Vec3f &direction, float t_max, Accelerator &accelerator);
+    static float calculateSphereIntersection(const Vec3f &origin, const Vec3f &direction, const SphereRecord &sphere);
+    static float calculateFaceIntersection(const Vec3f &origin, const Vec3f &direction, const TriangleRecord &triangle);
+    // the same tests for four rays, every lane gives exactly the result of the single ray version or -1 for a miss
+    static Float4 calculateSphereIntersection(const Vec3f4 &origin, const Vec3f4 &direction, const SphereRecord &sphere);
+    static Float4 calculateFaceIntersection(const Vec3f4 &origin, const Vec3f4 &direction, const TriangleRecord &triangle);
+    Vec3f computeColor(Accelerator &accelerator, const Background &background);
+    // color for a closest hit that has already been found, for example by packet traversal, primitive is -1 for a miss.
+    // Mirror reflections are followed in a loop that reuses this ray, so the ray ends at the last bounce
+    Vec3f computeColor(int primitive, float t, Accelerator &accelerator, const Background &background);
+    // ambient and point light contributions at the recorded hit, without reflections
+    Vec3f applyShading(Accelerator &accelerator, const Background &background);
+
+    // the steps of computeColor, for renderers that trace many rays of each kind together
+    int getDepth() const {return depth;}
+    const HitRecord &getHitRecord() const {return hit_record;}
+    // shadow ray from the recorded hit towards a light, t_light is the distance to the light
+    void shadowRay(const PointLight &light, const Background &background, Vec3f &shadow_origin, Vec3f &shadow_direction, float &t_light) const;
+    // diffuse and specular shading of the recorded hit by a light that is not occluded
+    Vec3f lightContribution(const PointLight &light) const;
+    // multiplies throughput by the mirror reflectance at the recorded hit, false if the reflection is not traced
+    bool reflectionWeight(Vec3f &throughput, const Background &background) const;
+    // turns this ray into the mirror reflection at the recorded hit
+    void reflect(const Background &background);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,54 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include "basicTypeDefinition.h"
+#include "Simd.h"
+
+#define PACKET_WIDTH 4                   // a packet covers a square block of PACKET_WIDTH x PACKET_WIDTH pixels
+#define PACKET_SIZE (PACKET_WIDTH * PACKET_WIDTH)
+#define PACKET_GROUPS (PACKET_SIZE / 4) // rays are processed four lanes at a time
+
+// coherent rays traced together, stored as structure of arrays so that four rays load into one register
+struct RayPacket
+{
+    alignas(16) float origin[3][PACKET_SIZE];
+    alignas(16) float direction[3][PACKET_SIZE];
+    alignas(16) float inv_direction[3][PACKET_SIZE];
+    int active[PACKET_GROUPS]; // one bit per lane of the group, cleared for pixels outside the image
+
+    RayPacket()
+    {
+        for (int lane = 0; lane < PACKET_SIZE; lane ++) setRay(lane, Vec3f(0, 0, 0), Vec3f(1, 1, 1));
+        for (int group = 0; group < PACKET_GROUPS; group ++) active[group] = 0;
+    }
+    void setRay(int lane, const Vec3f &o, const Vec3f &d)
+    {
+        for (int axis = 0; axis < 3; axis ++) {
+            origin[axis][lane] = o[axis];
+            direction[axis][lane] = d[axis];
+            inv_direction[axis][lane] = 1.0f / d[axis];
+        }
+        active[lane / 4] |= 1 << (lane % 4);
+    }
+    bool isActive(int lane) const {return active[lane / 4] & (1 << (lane % 4));}
+    Vec3f getOrigin(int lane) const {return Vec3f(origin[0][lane], origin[1][lane], origin[2][lane]);}
+    Vec3f getDirection(int lane) const {return Vec3f(direction[0][lane], direction[1][lane], direction[2][lane]);}
+    Vec3f4 origins(int group) const {return load(origin, group);}
+    Vec3f4 directions(int group) const {return load(direction, group);}
+    Vec3f4 invDirections(int group) const {return load(inv_direction, group);}
+
+private:
+    static Vec3f4 load(const float (&lanes)[3][PACKET_SIZE], int group)
+    {
+        return Vec3f4(Float4::load(lanes[0] + group * 4), Float4::load(lanes[1] + group * 4), Float4::load(lanes[2] + group * 4));
+    }
+};
+
+// closest hit of every ray in a packet, primitive is -1 and t is INFINITY for rays that hit nothing
+struct PacketHit
+{
+    alignas(16) float t[PACKET_SIZE];
+    int primitive[PACKET_SIZE];
+};
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef RENDER_OPTIONS_H
+#define RENDER_OPTIONS_H
+
+#include <string>
+
+// settings given on the command line that apply to the whole render
+struct RenderOptions
+{
+    std::string accelerator; // "bvh", "bvh4", "bvh8" or "kdtree"
+    std::string builder;     // "sah" or "lbvh" construction of the BVHs
+    bool treelets;           // restructures treelets of the BVHs after they are built
+    std::string sampling;    // "uniform" traces every sample of NumSamples, "adaptive" only refines pixels that need it
+    float adaptive_threshold; // luminance difference (0 to 255) of samples or neighbouring pixels that asks for more samples
+    float min_throughput;    // mirror bounces whose accumulated reflectance is below this in every channel are not traced
+    double time_budget;      // seconds for building and rendering, renders progressively and stops refining at the deadline, 0 for no limit
+    int threads;             // number of render threads, 0 for one per hardware thread
+    std::string ppm_format;  // "P6" (binary) or "P3" (ASCII) for cameras that do not choose one
+    std::string tone_map;    // "clamp" or "reinhard" conversion of the float framebuffer into the ppm
+    float exposure;          // the framebuffer is scaled by 2^exposure before it is tone mapped
+    bool write_pfm;          // also writes the float framebuffer of every camera as a pfm file
+    bool heatmaps;           // also writes false color images of the tracing cost of every pixel
+    std::string simd;        // "auto", "avx2" or "sse" kernels for the primitive blocks of the BVH leaves
+    std::string trace;       // "packet" (primary rays in packets), "single" (every ray on its own) or "wavefront" (queues of each ray kind)
+    bool write_images;       // false when only the timings are of interest
+    bool quiet;              // suppresses the build and traversal statistics
+    bool verbose;            // prints a breakdown of the scene loading time
+    bool scene_cache;        // reads and writes a compiled <scene>.xml.cache next to the scene file
+
+    RenderOptions() : accelerator("bvh"), builder("sah"), treelets(false), sampling("uniform"), adaptive_threshold(8), min_throughput(0), time_budget(0), threads(0), ppm_format("P6"), tone_map("clamp"), exposure(0), write_pfm(false), heatmaps(false), simd("auto"), trace("packet"), write_images(true), quiet(false), verbose(false), scene_cache(true) {}
+};
+
+#endif
@@ -3,6 +3,7 @@
 
 #include "basicTypeDefinition.h"
 #include "Camera.h"
+#include "RenderOptions.h"
 
 #include <string>
 
@@ -14,16 +15,26 @@ class Scene
 {
 public:
     Scene();
-    ~Scene() {
-        for (int i = 0; i < cameras.size(); ++ i) {
-            delete cameras[i];
-        }
-    }
+    ~Scene() {clear();}
+    void setOptions(const RenderOptions &options) {this->options = options;}
+    // reads the compiled scene cache next to the file when it matches, otherwise parses the xml and writes the cache
     void loadScene(const std::string &filename);
+    // renders all cameras and writes each image as soon as it is complete
     void renderScene();
-    void saveScene();
+    // wall clock times of the last renderScene call
+    double getBuildTime() const {return build_time_ms;}
+    double getRenderTime() const {return render_time_ms;}
+    int getThreadCount() const {return thread_count;}
 
 private:
+    RenderOptions options;
+    void parseScene(const std::string &filename);
+    bool loadCache(const std::string &cache_path, unsigned long long source_hash);
+    void saveCache(const std::string &cache_path, unsigned long long source_hash) const;
+    void clear();
+    double build_time_ms;
+    double render_time_ms;
+    int thread_count;
     Vec3i background_color;
     float shadow_ray_epsilon;
     int max_recursion_depth;
@@ -33,6 +44,7 @@ private:
     std::vector<Material> materials;
     std::vector<Vec3f> vertex_data;
     std::vector<Mesh> meshes;
+    std::vector<MeshInstance> mesh_instances;
     std::vector<Triangle> triangles;
     std::vector<Sphere> spheres;
 };
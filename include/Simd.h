@@ -0,0 +1,97 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+// four float lanes mapped to SSE registers on x86 and to plain arrays elsewhere, every operation rounds exactly
+// like the scalar float code so packet and single ray results are identical
+
+#include "LaneMath.h"
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <xmmintrin.h>
+
+class Mask4
+{
+public:
+    __m128 v;
+    Mask4() {}
+    explicit Mask4(__m128 v) : v(v) {}
+    // one bit per lane, lane 0 is the lowest bit
+    int bits() const {return _mm_movemask_ps(v);}
+    Mask4 operator&(const Mask4 &m) const {return Mask4(_mm_and_ps(v, m.v));}
+    Mask4 operator|(const Mask4 &m) const {return Mask4(_mm_or_ps(v, m.v));}
+};
+
+class Float4
+{
+public:
+    __m128 v;
+    Float4() {}
+    Float4(float f) : v(_mm_set1_ps(f)) {}
+    explicit Float4(__m128 v) : v(v) {}
+    static Float4 load(const float *p) {return Float4(_mm_load_ps(p));}
+    void store(float *p) const {_mm_store_ps(p, v);}
+    Float4 operator+(const Float4 &f) const {return Float4(_mm_add_ps(v, f.v));}
+    Float4 operator-(const Float4 &f) const {return Float4(_mm_sub_ps(v, f.v));}
+    Float4 operator*(const Float4 &f) const {return Float4(_mm_mul_ps(v, f.v));}
+    Float4 operator/(const Float4 &f) const {return Float4(_mm_div_ps(v, f.v));}
+    Float4 operator-() const {return Float4(_mm_xor_ps(v, _mm_set1_ps(-0.0f)));}
+    Mask4 operator<(const Float4 &f) const {return Mask4(_mm_cmplt_ps(v, f.v));}
+    Mask4 operator<=(const Float4 &f) const {return Mask4(_mm_cmple_ps(v, f.v));}
+    Mask4 operator>(const Float4 &f) const {return Mask4(_mm_cmpgt_ps(v, f.v));}
+    Mask4 operator>=(const Float4 &f) const {return Mask4(_mm_cmpge_ps(v, f.v));}
+    Mask4 operator==(const Float4 &f) const {return Mask4(_mm_cmpeq_ps(v, f.v));}
+    friend Float4 sqrt(const Float4 &f) {return Float4(_mm_sqrt_ps(f.v));}
+    friend Float4 abs(const Float4 &f) {return Float4(_mm_andnot_ps(_mm_set1_ps(-0.0f), f.v));}
+    // lanes of a where the mask is set, lanes of b elsewhere
+    friend Float4 select(const Mask4 &m, const Float4 &a, const Float4 &b)
+    {
+        return Float4(_mm_or_ps(_mm_and_ps(m.v, a.v), _mm_andnot_ps(m.v, b.v)));
+    }
+};
+
+#else
+
+class Mask4
+{
+public:
+    bool v[4];
+    Mask4() {}
+    int bits() const {return (v[0] ? 1 : 0) | (v[1] ? 2 : 0) | (v[2] ? 4 : 0) | (v[3] ? 8 : 0);}
+    Mask4 operator&(const Mask4 &m) const {Mask4 r; for (int i = 0; i < 4; i ++) r.v[i] = v[i] and m.v[i]; return r;}
+    Mask4 operator|(const Mask4 &m) const {Mask4 r; for (int i = 0; i < 4; i ++) r.v[i] = v[i] or m.v[i]; return r;}
+};
+
+class Float4
+{
+public:
+    float v[4];
+    Float4() {}
+    Float4(float f) {for (int i = 0; i < 4; i ++) v[i] = f;}
+    static Float4 load(const float *p) {Float4 r; for (int i = 0; i < 4; i ++) r.v[i] = p[i]; return r;}
+    void store(float *p) const {for (int i = 0; i < 4; i ++) p[i] = v[i];}
+    Float4 operator+(const Float4 &f) const {Float4 r; for (int i = 0; i < 4; i ++) r.v[i] = v[i] + f.v[i]; return r;}
+    Float4 operator-(const Float4 &f) const {Float4 r; for (int i = 0; i < 4; i ++) r.v[i] = v[i] - f.v[i]; return r;}
+    Float4 operator*(const Float4 &f) const {Float4 r; for (int i = 0; i < 4; i ++) r.v[i] = v[i] * f.v[i]; return r;}
+    Float4 operator/(const Float4 &f) const {Float4 r; for (int i = 0; i < 4; i ++) r.v[i] = v[i] / f.v[i]; return r;}
+    Float4 operator-() const {Float4 r; for (int i = 0; i < 4; i ++) r.v[i] = -v[i]; return r;}
+    Mask4 operator<(const Float4 &f) const {Mask4 r; for (int i = 0; i < 4; i ++) r.v[i] = v[i] < f.v[i]; return r;}
+    Mask4 operator<=(const Float4 &f) const {Mask4 r; for (int i = 0; i < 4; i ++) r.v[i] = v[i] <= f.v[i]; return r;}
+    Mask4 operator>(const Float4 &f) const {Mask4 r; for (int i = 0; i < 4; i ++) r.v[i] = v[i] > f.v[i]; return r;}
+    Mask4 operator>=(const Float4 &f) const {Mask4 r; for (int i = 0; i < 4; i ++) r.v[i] = v[i] >= f.v[i]; return r;}
+    Mask4 operator==(const Float4 &f) const {Mask4 r; for (int i = 0; i < 4; i ++) r.v[i] = v[i] == f.v[i]; return r;}
+    friend Float4 sqrt(const Float4 &f) {Float4 r; for (int i = 0; i < 4; i ++) r.v[i] = sqrtf(f.v[i]); return r;}
+    friend Float4 abs(const Float4 &f) {Float4 r; for (int i = 0; i < 4; i ++) r.v[i] = fabsf(f.v[i]); return r;}
+    friend Float4 select(const Mask4 &m, const Float4 &a, const Float4 &b)
+    {
+        Float4 r;
+        for (int i = 0; i < 4; i ++) r.v[i] = m.v[i] ? a.v[i] : b.v[i];
+        return r;
+    }
+};
+
+#endif
+
+typedef Vec3Lanes<Float4> Vec3f4;
+
+#endif
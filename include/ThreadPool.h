@@ -0,0 +1,45 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// persistent worker threads that process batches of indexed tasks, idle workers steal tasks from the others
+class ThreadPool
+{
+public:
+    // 0 threads means one per hardware thread
+    explicit ThreadPool(int num_threads);
+    ~ThreadPool();
+    int size() const {return workers.size();}
+    // calls task(index, worker) for every index in [0, num_tasks) and returns once all of them are done
+    void run(int num_tasks, const std::function<void(int, int)> &task);
+
+private:
+    struct WorkerQueue
+    {
+        std::mutex mutex;
+        std::deque<int> tasks;
+    };
+
+    std::vector<std::thread> workers;
+    std::vector<WorkerQueue> queues;
+    std::mutex mutex;
+    std::condition_variable work_available;
+    std::condition_variable work_done;
+    const std::function<void(int, int)> *current_task;
+    std::atomic<int> remaining;
+    int generation;
+    bool stopping;
+
+    void workerLoop(int worker);
+    // takes from the front of the worker's own queue, or from the back of another one when it is empty
+    bool popTask(int worker, int &task);
+};
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef TONE_MAP_H
+#define TONE_MAP_H
+
+#include <string>
+
+// converts a float framebuffer (3 floats per pixel, 255 is white) into 8 bit colors after scaling it by 2^exposure.
+// "clamp" rounds and clamps every channel, "reinhard" compresses the luminance so that the brightest pixel becomes white
+void toneMap(const float *hdr, int pixels, const std::string &op, float exposure, unsigned char *ldr);
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include "basicTypeDefinition.h"
+
+// affine transformation as a row major 4x4 matrix acting on column vectors, the last row is always 0 0 0 1
+class Transform
+{
+public:
+    float m[4][4];
+    // identity
+    Transform();
+    // the 16 values of the matrix row by row, throws if the last row is not 0 0 0 1
+    explicit Transform(const float *rows);
+    // throws if the matrix cannot be inverted
+    Transform inverse() const;
+    bool isIdentity() const;
+    Vec3f point(const Vec3f &p) const;
+    Vec3f vector(const Vec3f &v) const;
+    // multiplies by the transpose, so the inverse of a transform maps normals the way the transform maps surfaces
+    Vec3f normal(const Vec3f &n) const;
+};
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include "basicTypeDefinition.h"
+#include "Accelerator.h"
+#include "Ray.h"
+#include <vector>
+
+// breadth first renderer: all primary rays of a tile are traced first, then the shadow rays of every hit and then the
+// reflected rays, each kind from a queue sorted by direction octant and origin morton code so that neighbouring queries
+// walk the same nodes. Colors are accumulated in the order of Ray::computeColor and come out exactly the same.
+class Wavefront
+{
+public:
+    // colors of the primary rays, which are found in packets of PACKET_SIZE consecutive rays
+    void trace(const vector<Ray> &primary, Accelerator &accelerator, const Background &background, vector<Vec3f> &colors);
+
+private:
+    struct Path
+    {
+        Ray ray;          // the current segment, reflections continue in it
+        Vec3f throughput; // product of the mirror reflectances so far
+        int primitive;    // closest hit of the current segment, -1 for a miss
+        float t;
+    };
+    struct QueuedRay
+    {
+        int path;         // index into paths, for a shadow ray into hits
+        int light;        // the light of a shadow ray
+        Vec3f origin, direction;
+        float t_max;      // distance to the light for a shadow ray
+    };
+
+    // kept between tiles so that the queues are not reallocated
+    vector<Path> paths;               // one per primary ray, in the order of the colors
+    vector<int> active;               // paths whose current segment has been intersected
+    vector<int> hits;                 // the active paths whose segment hit something
+    vector<QueuedRay> shadow_queue;
+    vector<QueuedRay> reflection_queue;
+    vector<unsigned char> visible;    // per hit and light, true if the shadow ray reached the light
+    vector<unsigned long long> order; // the queue being traced, by direction octant and then origin morton code
+
+    // fills order with the queue indices, sorted by the octant of the direction and the morton code of the origin
+    static void sortQueue(const vector<QueuedRay> &queue, vector<unsigned long long> &order);
+};
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+
+#include "BVH.h"
+#include <vector>
+
+// a node with up to W children whose bounds are stored component by component, so that one ray tests all of them at once
+template <int W>
+struct alignas(16) WideBVHNode
+{
+    float bounds[6][W]; // min x, y, z and max x, y, z of every child, empty slots are at infinity
+    int child[W];       // node index of an interior child or the first block of a leaf child
+    int count[W];       // number of blocks of a leaf child, 0 for an interior child and -1 for an empty slot, which rays with NaN directions still hit
+};
+
+// BVH with W = 4 or 8 children per node, collapsed from the binary BVH and sharing its leaf blocks
+template <int W>
+class WideBVH : public BVH
+{
+public:
+    explicit WideBVH(const BuildOptions &options) : BVH(options), collapse_time_ms(0), binary_node_count(0), wide_leaf_count(0) {}
+    void build(vector<Sphere> &spheres, vector<Face> &faces, const Background &background);
+    int intersect(const Vec3f &origin, const Vec3f &direction, float &t, float t_max = INFINITY) const;
+    bool occluded(const Vec3f &origin, const Vec3f &direction, float t_max) const;
+    // the binary nodes are gone after the collapse, so packets are traced ray by ray
+    void intersectPacket(const RayPacket &packet, PacketHit &hit) const {Accelerator::intersectPacket(packet, hit);}
+    void printBuildStats() const;
+
+private:
+    vector<WideBVHNode<W> > wide_nodes;
+
+    double collapse_time_ms;
+    int binary_node_count;
+    int wide_leaf_count;
+
+    int collapse(int binary_node);
+    // slab test of the children of a node, returns a bit per child that is hit and its entry distance. The ray is passed
+    // both ways, the four wide groups use the broadcast lanes and the AVX2 test of BVH8 nodes the plain components
+    int intersectChildren(const WideBVHNode<W> &node, const Vec3f &origin, const Vec3f &inv_direction, const Vec3f4 &origin4, const Vec3f4 &inv_direction4,
+                          float t_max, float *t_near) const;
+};
+
+#endif
@@ -42,19 +42,27 @@ public:
     float x, y, z;
     Vec3f(float x, float y, float z) : x(x), y(y), z(z) {}
     Vec3f() : x(0), y(0), z(0) {}
-    float dot(Vec3f v)
+    float dot(const Vec3f &v) const
     {
         return this->x * v.x + this->y * v.y + this->z * v.z;
     }
-    Vec3f cross(Vec3f v)
+    Vec3f cross(const Vec3f &v) const
     {
         return Vec3f(this->y * v.z - this->z * v.y, this->z * v.x - this->x * v.z, this->x * v.y - this->y * v.x);
     }
-    Vec3f normalize()
+    Vec3f normalize() const
     {
         float length = sqrt(this->x * this->x + this->y * this->y + this->z * this->z);
         return Vec3f(this->x / length, this->y / length, this->z / length);
     }
+    float operator[](int axis) const
+    {
+        return axis == 0 ? x : (axis == 1 ? y : z);
+    }
+    float &operator[](int axis)
+    {
+        return axis == 0 ? x : (axis == 1 ? y : z);
+    }
     Vec3f operator+(const Vec3f &v) const
     {
         return Vec3f(this->x + v.x, this->y + v.y, this->z + v.z);
@@ -127,13 +135,14 @@ public:
     float t; // negative if no intersection
     Vec3f intersection_point;
     Vec3f normal;
-    Material material;
+    const Material *material; // points into the scene's materials
     int material_id;
     HitRecord()
     {
         this->t = -1;
         this->intersection_point = Vec3f(0, 0, 0);
         this->normal = Vec3f(0, 0, 0);
+        this->material = nullptr;
         this->material_id = -1;
     }
     HitRecord(float t, Vec3f intersection_point, Vec3f normal, int material_id)
@@ -141,6 +150,7 @@ public:
         this->t = t;
         this->intersection_point = intersection_point;
         this->normal = normal;
+        this->material = nullptr;
         this->material_id = material_id;
     }
 };
@@ -151,48 +161,44 @@ struct PointLight
     Vec3f intensity;
 };
 
+// read-only render context, the vectors are owned by the Scene and must outlive it
 class Background
 {
 private:
     Vec3i backgroundColor;
     Vec3f ambientLight;
     
-    vector<PointLight> pointLights;
-    vector <Vec3f> vertex_data;
-    vector <Material> material;
+    const vector<PointLight> *pointLights;
+    const vector<Vec3f> *vertex_data;
+    const vector<Material> *materials;
     int max_recursion_depth;
     float shadow_ray_epsilon;
+    float min_throughput;
 
 public:
     // constructors
-    Background()
+    Background(const Vec3i &backgroundColor, const Vec3f &ambientLight, const vector<PointLight> &pointLights, const vector<Vec3f> &vertex_data,
+               int max_recursion_depth, const vector<Material> &materials, float shadow_ray_epsilon, float min_throughput = 0)
     {
-        this->backgroundColor = Vec3i(0, 0, 0);
-        this->ambientLight = Vec3f(0, 0, 0);
-    }
-    Background(Vec3i backgroundColor, Vec3f ambientLight)
-    {
-        this->backgroundColor = backgroundColor;
-        this->ambientLight = ambientLight;
-    }
-    Background(Vec3i &backgroundColor, Vec3f &ambientLight, vector<PointLight> &pointLights, vector<Vec3f> &vertex_data, int &max_recursion_depth, vector<Material> &materials, float &shadow_ray_epsilon)
-    { //TODO: make them references
         this->backgroundColor = backgroundColor;
         this->ambientLight = ambientLight;
-        this->pointLights = pointLights;
-        this->vertex_data = vertex_data;
+        this->pointLights = &pointLights;
+        this->vertex_data = &vertex_data;
         this->max_recursion_depth = max_recursion_depth;
-        this->material = materials;
+        this->materials = &materials;
         this->shadow_ray_epsilon = shadow_ray_epsilon;
+        this->min_throughput = min_throughput;
     }
     // getters
-    Vec3i getBackgroundColor() {return this->backgroundColor;}
-    Vec3f getAmbientLight() {return this->ambientLight;}
-    vector<PointLight> getPointLights() {return this->pointLights;}
-    Vec3f getVertex(int id) {return vertex_data[id];}
-    int getMaxRecursionDepth() {return max_recursion_depth;}
-    Material getMaterial(int id) {return material[id];}
-    float getShadowRayEpsilon() {return shadow_ray_epsilon;}
+    const Vec3i &getBackgroundColor() const {return this->backgroundColor;}
+    const Vec3f &getAmbientLight() const {return this->ambientLight;}
+    const vector<PointLight> &getPointLights() const {return *this->pointLights;}
+    const Vec3f &getVertex(int id) const {return (*vertex_data)[id];}
+    int getMaxRecursionDepth() const {return max_recursion_depth;}
+    const Material &getMaterial(int id) const {return (*materials)[id];}
+    float getShadowRayEpsilon() const {return shadow_ray_epsilon;}
+    // mirror reflections stop once every channel of the accumulated mirror reflectance is below this
+    float getMinThroughput() const {return min_throughput;}
 };
 
 class Face
@@ -201,25 +207,18 @@ public:
     int v0_id;
     int v1_id;
     int v2_id;
-    Vec3f normal;
-    int material_id;
+    int material_id; // the normal is precomputed with the rest of the intersection data in TriangleRecord
 
-    // this function calculates the normal of the face
-    void calculateNormal(Vec3f v0, Vec3f v1, Vec3f v2)
-    {
-        Vec3f edge1 = v1 - v0;
-        Vec3f edge2 = v2 - v0;
-        this->normal = edge1.cross(edge2).normalize();
-    }
     Face() {
         v0_id = v1_id = v2_id = 0;
-        normal = Vec3f(0, 0, 0);
+        material_id = 0; // set from the mesh or triangle when the scene is rendered
     }
     Face(int v0_id, int v1_id, int v2_id)
     {
         this->v0_id = v0_id;
         this->v1_id = v1_id;
         this->v2_id = v2_id;
+        this->material_id = 0;
         // calculate the 3 vectors from the vertex data
     }
 };
@@ -253,4 +252,12 @@ public:
     float radius;
 };
 
+// another placement of a mesh that shares its faces, material_id is the instance's own material
+class MeshInstance : public Object
+{
+public:
+    int base_mesh;             // index of the mesh in the scene's mesh list
+    float transformation[16];  // row major object to world matrix
+};
+
 #endif
\ No newline at end of file
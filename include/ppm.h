@@ -1,6 +1,9 @@
 #ifndef __ppm_h__
 #define __ppm_h__
 
-void write_ppm(const char* filename, unsigned char* data, int width, int height);
+// binary writes the raw P6 format, otherwise the ASCII P3 format is used
+void write_ppm(const char* filename, unsigned char* data, int width, int height, bool binary = true);
+// little endian PF format with three floats per pixel, the rows are stored from the bottom of the image to the top
+void write_pfm(const char* filename, const float* data, int width, int height);
 
 #endif // __ppm_h__
@@ -0,0 +1,274 @@
+#include "../include/Accelerator.h"
+#include "../include/BVH.h"
+#include "../include/KdTree.h"
+#include "../include/WideBVH.h"
+#include "../include/Ray.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+
+#define CACHE_LINE 64
+#define MAX_STATS_SLOTS 1024 // threads that can count rays at the same time
+
+static TraversalStats total_stats;
+static std::mutex stats_mutex;
+
+// spreads the lowest 10 bits of v so that there are two zero bits between each of them
+static unsigned int expandBits(unsigned int v)
+{
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+unsigned int AABB::mortonCode(const Vec3f &p) const
+{
+    unsigned int quantized[3];
+    for (int axis = 0; axis < 3; axis ++) {
+        float extent = max[axis] - min[axis];
+        float x = extent > 0 ? (p[axis] - min[axis]) / extent : 0;
+        quantized[axis] = std::min(1023, std::max(0, (int)(x * 1024)));
+    }
+    return expandBits(quantized[0]) * 4 + expandBits(quantized[1]) * 2 + expandBits(quantized[2]);
+}
+
+float AABB::intersect(const Vec3f &origin, const Vec3f &inv_direction, float t_max) const
+{
+    float t_near, t_far;
+    return intersect(origin, inv_direction, t_max, t_near, t_far) ? t_near : INFINITY;
+}
+
+bool AABB::intersect(const Vec3f &origin, const Vec3f &inv_direction, float t_max, float &t_near, float &t_far) const
+{
+    // both ends are widened by a conservative bound for the rounding error of the slab distances,
+    // otherwise boxes of primitives that are hit at almost the same distance as t_max get culled
+    float t0 = 0, t1 = t_max * 1.0000004f;
+    for (int axis = 0; axis < 3; axis ++) {
+        float t_min_axis = (min[axis] - origin[axis]) * inv_direction[axis];
+        float t_max_axis = (max[axis] - origin[axis]) * inv_direction[axis];
+        if (t_min_axis > t_max_axis) std::swap(t_min_axis, t_max_axis);
+        t_max_axis *= 1.0000004f;
+        // written so that a NaN from a ray lying on a slab plane keeps the previous interval
+        t0 = t_min_axis > t0 ? t_min_axis : t0;
+        t1 = t_max_axis < t1 ? t_max_axis : t1;
+        if (t0 > t1) return false;
+    }
+    t_near = t0;
+    t_far = t1;
+    return true;
+}
+
+Mask4 AABB::intersect(const Vec3f4 &origin, const Vec3f4 &inv_direction, const Float4 &t_max) const
+{
+    // lane by lane the same operations as the single ray test above
+    Float4 t0(0.0f), t1 = t_max * Float4(1.0000004f);
+    for (int axis = 0; axis < 3; axis ++) {
+        Float4 t_min_axis = (Float4(min[axis]) - origin[axis]) * inv_direction[axis];
+        Float4 t_max_axis = (Float4(max[axis]) - origin[axis]) * inv_direction[axis];
+        Mask4 swap = t_min_axis > t_max_axis;
+        Float4 t_near = select(swap, t_max_axis, t_min_axis);
+        Float4 t_far = select(swap, t_min_axis, t_max_axis) * Float4(1.0000004f);
+        t0 = select(t_near > t0, t_near, t0);
+        t1 = select(t_far < t1, t_far, t1);
+    }
+    return t0 <= t1;
+}
+
+Accelerator *Accelerator::create(const std::string &type, const BuildOptions &options)
+{
+    if (type == "bvh") return new BVH(options);
+    if (type == "bvh4") return new WideBVH<4>(options);
+    if (type == "bvh8") return new WideBVH<8>(options);
+    if (type == "kdtree") return new KdTree();
+    throw std::runtime_error("Error: Unknown acceleration structure \"" + type + "\", expected bvh, bvh4, bvh8 or kdtree.");
+}
+
+void Accelerator::precomputePrimitives(vector<Sphere> &spheres, vector<Face> &faces, const Background &background)
+{
+    sphere_records.resize(spheres.size());
+    for (size_t i = 0; i < spheres.size(); i ++) {
+        sphere_records[i].center = background.getVertex(spheres[i].center_vertex_id-1);
+        sphere_records[i].radius_squared = spheres[i].radius * spheres[i].radius;
+        sphere_records[i].material_id = spheres[i].material_id;
+    }
+    triangles.resize(faces.size());
+    for (size_t i = 0; i < faces.size(); i ++) {
+        Vec3f v0 = background.getVertex(faces[i].v0_id-1);
+        Vec3f v1 = background.getVertex(faces[i].v1_id-1);
+        Vec3f v2 = background.getVertex(faces[i].v2_id-1);
+        triangles[i].v0 = v0;
+        triangles[i].edge1 = v1 - v0;
+        triangles[i].edge2 = v2 - v0;
+        triangles[i].normal = triangles[i].edge1.cross(triangles[i].edge2).normalize();
+        triangles[i].material_id = faces[i].material_id;
+    }
+}
+
+void Accelerator::appendBlocks(const int *primitives, int count, int width, vector<PrimitiveBlock> &blocks) const
+{
+    for (int is_sphere = 1; is_sphere >= 0; is_sphere --) {
+        PrimitiveBlock block;
+        memset(&block, 0, sizeof(block));
+        block.is_sphere = is_sphere;
+        for (int i = 0; i < count; i ++) {
+            int primitive = primitives[i];
+            if (isSphere(primitive) != (bool)is_sphere) continue;
+            int lane = block.count ++;
+            block.primitive[lane] = primitive;
+            if (is_sphere) {
+                const SphereRecord &sphere = getSphere(primitive);
+                for (int axis = 0; axis < 3; axis ++) block.rows[axis][lane] = sphere.center[axis];
+                block.rows[3][lane] = sphere.radius_squared;
+            }
+            else {
+                const TriangleRecord &triangle = getTriangle(primitive);
+                for (int axis = 0; axis < 3; axis ++) {
+                    block.rows[axis][lane] = triangle.v0[axis];
+                    block.rows[3 + axis][lane] = triangle.edge1[axis];
+                    block.rows[6 + axis][lane] = triangle.edge2[axis];
+                }
+            }
+            if (block.count == width) {
+                blocks.push_back(block);
+                memset(&block, 0, sizeof(block));
+                block.is_sphere = is_sphere;
+            }
+        }
+        if (block.count > 0) blocks.push_back(block);
+    }
+}
+
+void Accelerator::computePrimitiveBounds(vector<AABB> &bounds) const
+{
+    bounds.assign(primitiveCount(), AABB());
+    for (size_t i = 0; i < sphere_records.size(); i ++) {
+        float radius = sqrt(sphere_records[i].radius_squared);
+        Vec3f extent(radius, radius, radius);
+        bounds[i] = AABB(sphere_records[i].center - extent, sphere_records[i].center + extent);
+    }
+    for (size_t i = 0; i < triangles.size(); i ++) {
+        const TriangleRecord &triangle = triangles[i];
+        AABB &box = bounds[sphere_records.size() + i];
+        box.expand(triangle.v0);
+        box.expand(triangle.v0 + triangle.edge1);
+        box.expand(triangle.v0 + triangle.edge2);
+    }
+}
+
+float Accelerator::intersectPrimitive(const Vec3f &origin, const Vec3f &direction, int primitive) const
+{
+    TraversalStats &stats = threadStats();
+    (isSphere(primitive) ? stats.sphere_tests : stats.triangle_tests) ++;
+    if (isSphere(primitive)) return Ray::calculateSphereIntersection(origin, direction, getSphere(primitive));
+    return Ray::calculateFaceIntersection(origin, direction, getTriangle(primitive));
+}
+
+Float4 Accelerator::intersectPrimitive(const Vec3f4 &origin, const Vec3f4 &direction, int primitive, int active) const
+{
+    TraversalStats &stats = threadStats();
+    (isSphere(primitive) ? stats.sphere_tests : stats.triangle_tests) += __builtin_popcount(active);
+    if (isSphere(primitive)) return Ray::calculateSphereIntersection(origin, direction, getSphere(primitive));
+    return Ray::calculateFaceIntersection(origin, direction, getTriangle(primitive));
+}
+
+void Accelerator::surfaceAt(int primitive, const Vec3f &point, Vec3f &normal, int &material_id) const
+{
+    if (isSphere(primitive)) {
+        const SphereRecord &sphere = getSphere(primitive);
+        material_id = sphere.material_id;
+        normal = (point - sphere.center).normalize();
+    }
+    else {
+        const TriangleRecord &triangle = getTriangle(primitive);
+        material_id = triangle.material_id;
+        normal = triangle.normal;
+    }
+}
+
+void Accelerator::intersectPacket(const RayPacket &packet, PacketHit &hit) const
+{
+    for (int lane = 0; lane < PACKET_SIZE; lane ++) {
+        hit.t[lane] = INFINITY;
+        hit.primitive[lane] = -1;
+        if (packet.isActive(lane)) {
+            hit.primitive[lane] = intersect(packet.getOrigin(lane), packet.getDirection(lane), hit.t[lane]);
+        }
+    }
+}
+
+namespace
+{
+    // counters of one thread, padded to whole cache lines so that threads counting at the same time never share a line
+    struct alignas(CACHE_LINE) StatsSlot
+    {
+        TraversalStats stats;
+        bool in_use;
+    };
+
+    StatsSlot stats_slots[MAX_STATS_SLOTS];
+
+    // takes a free slot for the lifetime of its thread, the counts stay in the slot until they are merged
+    struct SlotHolder
+    {
+        StatsSlot *slot;
+        SlotHolder() : slot(NULL)
+        {
+            std::lock_guard<std::mutex> lock(stats_mutex);
+            for (int i = 0; i < MAX_STATS_SLOTS and slot == NULL; i ++) {
+                if (!stats_slots[i].in_use) slot = &stats_slots[i];
+            }
+            if (slot == NULL) throw std::runtime_error("Error: Too many threads are tracing rays at the same time.");
+            slot->in_use = true;
+        }
+        ~SlotHolder()
+        {
+            std::lock_guard<std::mutex> lock(stats_mutex);
+            slot->in_use = false;
+        }
+    };
+}
+
+TraversalStats &Accelerator::threadStats()
+{
+    static thread_local SlotHolder holder;
+    return holder.slot->stats;
+}
+
+void Accelerator::mergeThreadStats()
+{
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    for (int i = 0; i < MAX_STATS_SLOTS; i ++) {
+        total_stats.add(stats_slots[i].stats);
+        stats_slots[i].stats = TraversalStats();
+    }
+}
+
+void Accelerator::printTraversalStats(double seconds)
+{
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    double rays = total_stats.rays > 0 ? total_stats.rays : 1;
+    double mrays = seconds > 0 ? 1e-6 / seconds : 0;
+    std::cout << "Traversal: " << total_stats.rays << " rays (" << total_stats.primary_rays << " primary, " << total_stats.shadow_rays
+              << " shadow, " << total_stats.reflection_rays << " reflection), " << total_stats.nodes_visited / rays << " nodes, "
+              << total_stats.triangle_tests / rays << " triangle and " << total_stats.sphere_tests / rays << " sphere tests per ray, "
+              << 100.0 * total_stats.hits / rays << "% hit" << std::endl
+              << "Mrays/s: " << total_stats.primary_rays * mrays << " primary, " << total_stats.shadow_rays * mrays << " shadow, "
+              << total_stats.reflection_rays * mrays << " reflection, " << total_stats.rays * mrays << " total" << std::endl;
+}
+
+TraversalStats Accelerator::totalStats()
+{
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    return total_stats;
+}
+
+void Accelerator::resetStats()
+{
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    total_stats = TraversalStats();
+}
@@ -0,0 +1,246 @@
+#include "../include/BVH.h"
+#include "../include/Ray.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+#define MAX_DEPTH 60 // keeps the traversal stack below its fixed size of 64
+
+void BVH::build(vector<Sphere> &spheres, vector<Face> &faces, const Background &background)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    precomputePrimitives(spheres, faces, background);
+    kernels = &blockKernels();
+    max_leaf_size = kernels->width;
+    nodes.clear();
+    blocks.clear();
+    max_depth = leaf_count = 0;
+
+    vector<AABB> bounds;
+    computePrimitiveBounds(bounds);
+    BVHBuilder builder(bounds, max_leaf_size, MAX_DEPTH, build_options.pool);
+    if (build_options.builder == "lbvh") builder.buildLBVH();
+    else builder.buildSAH();
+    if (build_options.treelets) builder.optimizeTreelets();
+    primitive_ids.swap(builder.primitive_ids);
+    if (!builder.nodes.empty()) {
+        nodes.reserve(builder.nodes.size());
+        flatten(builder.nodes, 0, 0);
+    }
+    vector<BuildNode>().swap(builder.nodes);
+
+    // expected cost of a random ray hitting the root, relative to the root's surface area
+    sah_cost = 0;
+    if (!nodes.empty() and nodes[0].bounds.surfaceArea() > 0) {
+        float root_area = nodes[0].bounds.surfaceArea();
+        for (size_t i = 0; i < nodes.size(); i ++) {
+            float relative_area = nodes[i].bounds.surfaceArea() / root_area;
+            if (nodes[i].count > 0) sah_cost += relative_area * nodes[i].count * INTERSECTION_COST;
+            else sah_cost += relative_area * TRAVERSAL_COST;
+        }
+    }
+
+    // leaves switch from primitive ranges to the blocks that the intersection kernels read
+    for (size_t i = 0; i < nodes.size(); i ++) {
+        if (nodes[i].count == 0) continue;
+        int first_block = blocks.size();
+        appendBlocks(primitive_ids.data() + nodes[i].offset, nodes[i].count, max_leaf_size, blocks);
+        nodes[i].offset = first_block;
+        nodes[i].count = blocks.size() - first_block;
+    }
+    vector<int>().swap(primitive_ids);
+    build_time_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+int BVH::flatten(const vector<BuildNode> &build_nodes, int node, int depth)
+{
+    const BuildNode &build_node = build_nodes[node];
+    int node_index = nodes.size();
+    nodes.push_back(BVHNode());
+    nodes[node_index].bounds = build_node.bounds;
+    max_depth = std::max(max_depth, depth);
+    if (build_node.left < 0) {
+        nodes[node_index].offset = build_node.begin;
+        nodes[node_index].count = build_node.count;
+        leaf_count ++;
+        return node_index;
+    }
+    flatten(build_nodes, build_node.left, depth + 1);
+    int right = flatten(build_nodes, build_node.right, depth + 1);
+    nodes[node_index].offset = right;
+    nodes[node_index].count = 0;
+    nodes[node_index].axis = build_node.axis;
+    return node_index;
+}
+
+std::string BVH::builderName() const
+{
+    return build_options.builder + (build_options.treelets ? " + treelets" : "");
+}
+
+int BVH::intersect(const Vec3f &origin, const Vec3f &direction, float &t, float t_max) const
+{
+    TraversalStats &stats = threadStats();
+    stats.rays ++;
+    t = t_max;
+    if (nodes.empty()) return -1;
+
+    Vec3f inv_direction(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+    bool direction_is_negative[3] = {inv_direction.x < 0, inv_direction.y < 0, inv_direction.z < 0};
+
+    int hit = -1;
+    int stack[64];
+    int stack_size = 0;
+    int node_index = 0;
+    while (true) {
+        const BVHNode &node = nodes[node_index];
+        stats.nodes_visited ++;
+        if (node.bounds.intersect(origin, inv_direction, t) != INFINITY) {
+            if (node.count > 0) {
+                for (int i = node.offset; i < node.offset + node.count; i ++) {
+                    (blocks[i].is_sphere ? stats.sphere_tests : stats.triangle_tests) += blocks[i].count;
+                    kernels->intersect(blocks[i], &origin.x, &direction.x, t, hit);
+                }
+                if (stack_size == 0) break;
+                node_index = stack[-- stack_size];
+            }
+            else if (direction_is_negative[node.axis]) { // visit the child on the far side of the split last
+                stack[stack_size ++] = node_index + 1;
+                node_index = node.offset;
+            }
+            else {
+                stack[stack_size ++] = node.offset;
+                node_index = node_index + 1;
+            }
+        }
+        else {
+            if (stack_size == 0) break;
+            node_index = stack[-- stack_size];
+        }
+    }
+    return hit;
+}
+
+bool BVH::occluded(const Vec3f &origin, const Vec3f &direction, float t_max) const
+{
+    TraversalStats &stats = threadStats();
+    stats.rays ++;
+    if (nodes.empty()) return false;
+
+    Vec3f inv_direction(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+    int stack[64];
+    int stack_size = 0;
+    int node_index = 0;
+    while (true) {
+        const BVHNode &node = nodes[node_index];
+        stats.nodes_visited ++;
+        if (node.bounds.intersect(origin, inv_direction, t_max) != INFINITY) {
+            if (node.count > 0) {
+                for (int i = node.offset; i < node.offset + node.count; i ++) {
+                    (blocks[i].is_sphere ? stats.sphere_tests : stats.triangle_tests) += blocks[i].count;
+                    if (kernels->occluded(blocks[i], &origin.x, &direction.x, t_max)) return true;
+                }
+                if (stack_size == 0) break;
+                node_index = stack[-- stack_size];
+            }
+            else { // any hit terminates the query, so the children are not ordered
+                stack[stack_size ++] = node.offset;
+                node_index = node_index + 1;
+            }
+        }
+        else {
+            if (stack_size == 0) break;
+            node_index = stack[-- stack_size];
+        }
+    }
+    return false;
+}
+
+void BVH::intersectPacket(const RayPacket &packet, PacketHit &hit) const
+{
+    TraversalStats &stats = threadStats();
+    int first_lane = -1;
+    for (int lane = 0; lane < PACKET_SIZE; lane ++) {
+        hit.t[lane] = INFINITY;
+        hit.primitive[lane] = -1;
+        if (packet.isActive(lane)) {
+            stats.rays ++;
+            if (first_lane < 0) first_lane = lane;
+        }
+    }
+    if (nodes.empty() or first_lane < 0) return;
+
+    Vec3f4 origin[PACKET_GROUPS], direction[PACKET_GROUPS], inv_direction[PACKET_GROUPS];
+    for (int group = 0; group < PACKET_GROUPS; group ++) {
+        origin[group] = packet.origins(group);
+        direction[group] = packet.directions(group);
+        inv_direction[group] = packet.invDirections(group);
+    }
+    // the front to back order follows the first ray, which for coherent packets is the order of almost every ray
+    bool direction_is_negative[3];
+    for (int axis = 0; axis < 3; axis ++) {
+        direction_is_negative[axis] = packet.inv_direction[axis][first_lane] < 0;
+    }
+
+    int stack[64];
+    int stack_size = 0;
+    int node_index = 0;
+    while (true) {
+        const BVHNode &node = nodes[node_index];
+        stats.nodes_visited ++;
+        // lanes that hit the node, a leaf only tests its primitives against these
+        int lanes_hit[PACKET_GROUPS];
+        bool any_hit = false;
+        for (int group = 0; group < PACKET_GROUPS; group ++) {
+            lanes_hit[group] = 0;
+            if (packet.active[group] == 0) continue;
+            lanes_hit[group] = node.bounds.intersect(origin[group], inv_direction[group], Float4::load(hit.t + group * 4)).bits() & packet.active[group];
+            any_hit = any_hit or lanes_hit[group] != 0;
+        }
+        if (any_hit and node.count == 0) {
+            if (direction_is_negative[node.axis]) { // visit the child on the far side of the split last
+                stack[stack_size ++] = node_index + 1;
+                node_index = node.offset;
+            }
+            else {
+                stack[stack_size ++] = node.offset;
+                node_index = node_index + 1;
+            }
+            continue;
+        }
+        if (any_hit) {
+            for (int i = node.offset; i < node.offset + node.count; i ++) {
+                const PrimitiveBlock &block = blocks[i];
+                for (int j = 0; j < block.count; j ++) {
+                    int primitive = block.primitive[j];
+                    for (int group = 0; group < PACKET_GROUPS; group ++) {
+                        if (lanes_hit[group] == 0) continue;
+                        Float4 t_primitive = intersectPrimitive(origin[group], direction[group], primitive, lanes_hit[group]);
+                        float *t = hit.t + group * 4;
+                        int closer = ((t_primitive > Float4(0.0f)) & (t_primitive <= Float4::load(t))).bits() & lanes_hit[group];
+                        if (closer == 0) continue;
+                        alignas(16) float t_lanes[4];
+                        t_primitive.store(t_lanes);
+                        for (int lane = 0; lane < 4; lane ++) {
+                            int *hit_primitive = hit.primitive + group * 4 + lane;
+                            if ((closer & (1 << lane)) and closerHit(t_lanes[lane], primitive, t[lane], *hit_primitive)) {
+                                t[lane] = t_lanes[lane];
+                                *hit_primitive = primitive;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        if (stack_size == 0) break;
+        node_index = stack[-- stack_size];
+    }
+}
+
+void BVH::printBuildStats() const
+{
+    std::cout << "BVH: " << primitiveCount() << " primitives, " << nodes.size() << " nodes, " << leaf_count << " leaves in " << blocks.size()
+              << " " << kernels->name << " blocks, depth " << max_depth << ", SAH cost " << sah_cost << ", built with " << builderName() << " in "
+              << build_time_ms << " ms" << std::endl;
+}
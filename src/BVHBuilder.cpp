@@ -0,0 +1,431 @@
+#include "../include/BVHBuilder.h"
+#include "../include/ThreadPool.h"
+
+#include <algorithm>
+
+#define NUM_BINS 16
+#define MIN_TASK_SIZE 4096   // smaller subtrees are not worth a task of their own
+#define TASKS_PER_THREAD 8   // enough subtrees that idle workers can steal from the large ones
+#define PARALLEL_GRAIN 16384 // primitives per chunk when one range is scanned by several workers
+#define TREELET_SIZE 7       // leaves of a treelet, the optimal topology is searched over all 2^7 subsets
+
+BVHBuilder::BVHBuilder(const vector<AABB> &bounds, int max_leaf_size, int max_depth, ThreadPool *pool)
+    : bounds(bounds), max_leaf_size(max_leaf_size), max_depth(max_depth), pool(pool), lbvh(false)
+{
+    int num_primitives = bounds.size();
+    centroids.resize(num_primitives);
+    primitive_ids.resize(num_primitives);
+    parallelFor(num_primitives, [&](int, int begin, int end) {
+        for (int i = begin; i < end; i ++) {
+            centroids[i] = bounds[i].centroid();
+            primitive_ids[i] = i;
+        }
+    });
+}
+
+void BVHBuilder::buildSAH()
+{
+    lbvh = false;
+    build();
+}
+
+void BVHBuilder::buildLBVH()
+{
+    lbvh = true;
+    sortByMortonCode();
+    build();
+}
+
+void BVHBuilder::build()
+{
+    nodes.clear();
+    task_roots.clear();
+    int num_primitives = primitive_ids.size();
+    if (num_primitives == 0) return;
+    nodes.reserve(2 * num_primitives);
+    if (pool == NULL or pool->size() == 1) {
+        buildRecursive(nodes, 0, num_primitives, 0, 0, NULL);
+        return;
+    }
+
+    // the top of the tree is split here, the subtrees below it are built by the workers and then appended
+    vector<Task> tasks;
+    buildRecursive(nodes, 0, num_primitives, 0, std::max(MIN_TASK_SIZE, num_primitives / (TASKS_PER_THREAD * pool->size())), &tasks);
+    vector<vector<BuildNode> > subtrees(tasks.size());
+    pool->run(tasks.size(), [&](int i, int) {
+        subtrees[i].reserve(2 * (tasks[i].end - tasks[i].begin));
+        buildRecursive(subtrees[i], tasks[i].begin, tasks[i].end, tasks[i].depth, 0, NULL);
+    });
+    for (size_t i = 0; i < tasks.size(); i ++) {
+        // the subtree root replaces the placeholder node, all other nodes are appended
+        int base = nodes.size() - 1;
+        for (size_t j = 0; j < subtrees[i].size(); j ++) {
+            BuildNode node = subtrees[i][j];
+            if (node.left >= 0) {
+                node.left += base;
+                node.right += base;
+            }
+            if (j == 0) nodes[tasks[i].node] = node;
+            else nodes.push_back(node);
+        }
+        task_roots.push_back(tasks[i].node);
+        vector<BuildNode>().swap(subtrees[i]);
+    }
+}
+
+int BVHBuilder::buildRecursive(vector<BuildNode> &out, int begin, int end, int depth, int task_size, vector<Task> *tasks)
+{
+    int node_index = out.size();
+    out.push_back(BuildNode());
+    BuildNode &node = out.back();
+    node.left = node.right = -1;
+    node.begin = begin;
+    node.count = end - begin;
+    node.axis = 0;
+    if (tasks != NULL and end - begin <= task_size) {
+        Task task = {node_index, begin, end, depth};
+        tasks->push_back(task);
+        return node_index;
+    }
+
+    // only the top of the tree, which is built before there are tasks, scans its ranges in parallel
+    bool parallel = tasks != NULL;
+    int count = end - begin;
+    vector<AABB> chunk_bounds(2 * chunkCount(parallel ? count : 0));
+    parallelFor(count, [&](int chunk, int chunk_begin, int chunk_end) {
+        for (int i = begin + chunk_begin; i < begin + chunk_end; i ++) {
+            chunk_bounds[2 * chunk].expand(bounds[primitive_ids[i]]);
+            chunk_bounds[2 * chunk + 1].expand(centroids[primitive_ids[i]]);
+        }
+    }, parallel);
+    AABB node_bounds, centroid_bounds;
+    for (size_t i = 0; i < chunk_bounds.size(); i += 2) {
+        node_bounds.expand(chunk_bounds[i]);
+        centroid_bounds.expand(chunk_bounds[i + 1]);
+    }
+    out[node_index].bounds = node_bounds;
+
+    int mid, axis;
+    if (count <= 1 or depth >= max_depth or !split(begin, end, centroid_bounds, node_bounds, parallel, mid, axis)) {
+        return node_index;
+    }
+    int left = buildRecursive(out, begin, mid, depth + 1, task_size, tasks);
+    int right = buildRecursive(out, mid, end, depth + 1, task_size, tasks);
+    out[node_index].left = left;
+    out[node_index].right = right;
+    out[node_index].count = 0;
+    out[node_index].axis = axis;
+    return node_index;
+}
+
+bool BVHBuilder::split(int begin, int end, const AABB &centroid_bounds, const AABB &node_bounds, bool parallel, int &mid, int &axis)
+{
+    if (lbvh) return splitMorton(begin, end, mid, axis);
+    return splitSAH(begin, end, centroid_bounds, node_bounds, parallel, mid, axis);
+}
+
+bool BVHBuilder::splitSAH(int begin, int end, const AABB &centroid_bounds, const AABB &node_bounds, bool parallel, int &mid, int &axis)
+{
+    // bins of all three axes in one pass, chunks of a large range are binned by different workers and merged
+    struct Bins
+    {
+        AABB bounds[3][NUM_BINS];
+        int count[3][NUM_BINS];
+    };
+    int count = end - begin;
+    vector<Bins> chunk_bins(chunkCount(parallel ? count : 0));
+    float scale[3];
+    for (int a = 0; a < 3; a ++) {
+        float extent = centroid_bounds.max[a] - centroid_bounds.min[a];
+        scale[a] = extent > 0 ? NUM_BINS / extent : 0;
+    }
+    parallelFor(count, [&](int chunk, int chunk_begin, int chunk_end) {
+        Bins &bins = chunk_bins[chunk];
+        for (int a = 0; a < 3; a ++) {
+            for (int bin = 0; bin < NUM_BINS; bin ++) {
+                bins.bounds[a][bin] = AABB();
+                bins.count[a][bin] = 0;
+            }
+            if (scale[a] == 0) continue;
+            for (int i = begin + chunk_begin; i < begin + chunk_end; i ++) {
+                int bin = std::min(NUM_BINS - 1, (int)((centroids[primitive_ids[i]][a] - centroid_bounds.min[a]) * scale[a]));
+                bins.count[a][bin] ++;
+                bins.bounds[a][bin].expand(bounds[primitive_ids[i]]);
+            }
+        }
+    }, parallel);
+    Bins &bins = chunk_bins[0];
+    for (size_t chunk = 1; chunk < chunk_bins.size(); chunk ++) {
+        for (int a = 0; a < 3; a ++) {
+            for (int bin = 0; bin < NUM_BINS; bin ++) {
+                bins.bounds[a][bin].expand(chunk_bins[chunk].bounds[a][bin]);
+                bins.count[a][bin] += chunk_bins[chunk].count[a][bin];
+            }
+        }
+    }
+
+    // evaluate the surface area heuristic at the boundaries of equally sized centroid bins on every axis
+    float best_cost = INFINITY;
+    int best_axis = -1, best_bin = -1;
+    for (int a = 0; a < 3; a ++) {
+        if (scale[a] == 0) continue;
+        const AABB *bin_bounds = bins.bounds[a];
+        const int *bin_count = bins.count[a];
+        float left_area[NUM_BINS - 1];
+        int left_count[NUM_BINS - 1];
+        AABB accumulated;
+        int accumulated_count = 0;
+        for (int i = 0; i < NUM_BINS - 1; i ++) {
+            if (bin_count[i] > 0) accumulated.expand(bin_bounds[i]);
+            accumulated_count += bin_count[i];
+            left_area[i] = accumulated.surfaceArea();
+            left_count[i] = accumulated_count;
+        }
+        accumulated = AABB();
+        accumulated_count = 0;
+        for (int i = NUM_BINS - 1; i > 0; i --) {
+            if (bin_count[i] > 0) accumulated.expand(bin_bounds[i]);
+            accumulated_count += bin_count[i];
+            if (left_count[i-1] == 0 or accumulated_count == 0) continue;
+            float cost = left_area[i-1] * left_count[i-1] + accumulated.surfaceArea() * accumulated_count;
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = a;
+                best_bin = i;
+            }
+        }
+    }
+
+    if (best_axis == -1) { // all centroids coincide, split by index
+        if (count <= max_leaf_size) return false;
+        axis = 0;
+        mid = (begin + end) / 2;
+        return true;
+    }
+    float parent_area = node_bounds.surfaceArea();
+    float split_cost = TRAVERSAL_COST + INTERSECTION_COST * (parent_area > 0 ? best_cost / parent_area : count);
+    if (count <= max_leaf_size and split_cost >= count * INTERSECTION_COST) return false;
+    float min = centroid_bounds.min[best_axis];
+    float bin_scale = scale[best_axis];
+    axis = best_axis;
+    mid = std::partition(primitive_ids.begin() + begin, primitive_ids.begin() + end, [&](int id) {
+        return std::min(NUM_BINS - 1, (int)((centroids[id][best_axis] - min) * bin_scale)) < best_bin;
+    }) - primitive_ids.begin();
+    return true;
+}
+
+bool BVHBuilder::splitMorton(int begin, int end, int &mid, int &axis)
+{
+    if (end - begin <= max_leaf_size) return false;
+    unsigned int first = morton_codes[begin], last = morton_codes[end - 1];
+    if (first == last) { // identical codes, split by index
+        axis = 0;
+        mid = (begin + end) / 2;
+        return true;
+    }
+    // the codes are sorted, so the range splits where its highest differing bit becomes one
+    int bit = 31 - __builtin_clz(first ^ last);
+    mid = std::partition_point(morton_codes.begin() + begin, morton_codes.begin() + end, [&](unsigned int code) {
+        return (code & (1u << bit)) == 0;
+    }) - morton_codes.begin();
+    axis = 2 - bit % 3;
+    return true;
+}
+
+void BVHBuilder::sortByMortonCode()
+{
+    int num_primitives = primitive_ids.size();
+    AABB centroid_bounds;
+    for (int i = 0; i < num_primitives; i ++) {
+        centroid_bounds.expand(centroids[i]);
+    }
+    // code in the high half and primitive id in the low half, so equal codes keep a deterministic order
+    vector<unsigned long long> keys(num_primitives);
+    parallelFor(num_primitives, [&](int, int begin, int end) {
+        for (int i = begin; i < end; i ++) {
+            keys[i] = (unsigned long long)centroid_bounds.mortonCode(centroids[i]) << 32 | (unsigned int)i;
+        }
+    });
+
+    // sorted in a power of two number of chunks that are then merged pairwise
+    int chunks = 1;
+    while (pool != NULL and chunks < pool->size() and num_primitives / (2 * chunks) >= PARALLEL_GRAIN) chunks *= 2;
+    vector<int> chunk_begin(chunks + 1);
+    for (int i = 0; i <= chunks; i ++) {
+        chunk_begin[i] = (long long)num_primitives * i / chunks;
+    }
+    if (chunks == 1) {
+        std::sort(keys.begin(), keys.end());
+    }
+    else {
+        pool->run(chunks, [&](int i, int) {
+            std::sort(keys.begin() + chunk_begin[i], keys.begin() + chunk_begin[i + 1]);
+        });
+        for (int width = 1; width < chunks; width *= 2) {
+            pool->run(chunks / (2 * width), [&](int i, int) {
+                int first = 2 * width * i;
+                std::inplace_merge(keys.begin() + chunk_begin[first], keys.begin() + chunk_begin[first + width],
+                                   keys.begin() + chunk_begin[first + 2 * width]);
+            });
+        }
+    }
+
+    morton_codes.resize(num_primitives);
+    parallelFor(num_primitives, [&](int, int begin, int end) {
+        for (int i = begin; i < end; i ++) {
+            morton_codes[i] = keys[i] >> 32;
+            primitive_ids[i] = keys[i] & 0xFFFFFFFFu;
+        }
+    });
+}
+
+void BVHBuilder::optimizeTreelets()
+{
+    if (nodes.size() < 5) return;
+    vector<BuildNode> original = nodes;
+    vector<float> cost(nodes.size(), -1.0f);
+    // the subtrees of the tasks are independent, the nodes above them are optimized afterwards
+    if (!task_roots.empty()) {
+        pool->run(task_roots.size(), [&](int i, int) {
+            optimizeTreelets(task_roots[i], cost);
+        });
+    }
+    optimizeTreelets(0, cost);
+    // the traversal stacks have a fixed size, a tree that got deeper than the builders allow is not used
+    if (depth(0) > max_depth) nodes.swap(original);
+}
+
+float BVHBuilder::optimizeTreelets(int node, vector<float> &cost)
+{
+    if (cost[node] >= 0) return cost[node];
+    const BuildNode &build_node = nodes[node];
+    if (build_node.left < 0) {
+        cost[node] = INTERSECTION_COST * build_node.bounds.surfaceArea() * build_node.count;
+        return cost[node];
+    }
+    // bottom up, so that every treelet is formed from subtrees that are already optimized
+    optimizeTreelets(build_node.left, cost);
+    optimizeTreelets(build_node.right, cost);
+    cost[node] = optimizeTreelet(node, cost);
+    return cost[node];
+}
+
+float BVHBuilder::optimizeTreelet(int root, vector<float> &cost)
+{
+    float current = TRAVERSAL_COST * nodes[root].bounds.surfaceArea() + cost[nodes[root].left] + cost[nodes[root].right];
+
+    // grow the treelet by opening the largest of its leaves until it has TREELET_SIZE of them
+    int leaves[TREELET_SIZE], internal[TREELET_SIZE - 1];
+    int leaf_count = 2, internal_count = 1;
+    leaves[0] = nodes[root].left;
+    leaves[1] = nodes[root].right;
+    internal[0] = root;
+    while (leaf_count < TREELET_SIZE) {
+        int largest = -1;
+        float largest_area = -1;
+        for (int i = 0; i < leaf_count; i ++) {
+            if (nodes[leaves[i]].left >= 0 and nodes[leaves[i]].bounds.surfaceArea() > largest_area) {
+                largest = i;
+                largest_area = nodes[leaves[i]].bounds.surfaceArea();
+            }
+        }
+        if (largest < 0) break;
+        int opened = leaves[largest];
+        internal[internal_count ++] = opened;
+        leaves[largest] = nodes[opened].left;
+        leaves[leaf_count ++] = nodes[opened].right;
+    }
+    if (leaf_count < 3) return current;
+
+    // lowest cost of a subtree over every subset of the leaves, subsets are numbered so that both parts of a split come first
+    int full = (1 << leaf_count) - 1;
+    AABB subset_bounds[1 << TREELET_SIZE];
+    float subset_cost[1 << TREELET_SIZE];
+    int subset_split[1 << TREELET_SIZE];
+    for (int s = 1; s <= full; s ++) {
+        int lowest = s & -s;
+        const BuildNode &leaf = nodes[leaves[__builtin_ctz(s)]];
+        if (s == lowest) {
+            subset_bounds[s] = leaf.bounds;
+            subset_cost[s] = cost[leaves[__builtin_ctz(s)]];
+            continue;
+        }
+        subset_bounds[s] = subset_bounds[s ^ lowest];
+        subset_bounds[s].expand(leaf.bounds);
+        // only the parts that contain the lowest leaf, the other half of each split is the same split mirrored
+        float best = INFINITY;
+        for (int part = (s - 1) & s; part > 0; part = (part - 1) & s) {
+            if (!(part & lowest)) continue;
+            float split_cost = subset_cost[part] + subset_cost[s ^ part];
+            if (split_cost < best) {
+                best = split_cost;
+                subset_split[s] = part;
+            }
+        }
+        subset_cost[s] = TRAVERSAL_COST * subset_bounds[s].surfaceArea() + best;
+    }
+    if (!(subset_cost[full] < current)) return current;
+
+    // rebuild the treelet top down, reusing its interior nodes
+    int pending_subset[TREELET_SIZE], pending_node[TREELET_SIZE];
+    int pending = 0, next_internal = 1;
+    pending_subset[pending] = full;
+    pending_node[pending ++] = root;
+    while (pending > 0) {
+        pending --;
+        int s = pending_subset[pending], node = pending_node[pending];
+        int parts[2] = {subset_split[s], s ^ subset_split[s]};
+        int children[2];
+        Vec3f child_centroids[2];
+        for (int k = 0; k < 2; k ++) {
+            if ((parts[k] & (parts[k] - 1)) == 0) {
+                children[k] = leaves[__builtin_ctz(parts[k])];
+            }
+            else {
+                children[k] = internal[next_internal ++];
+                pending_subset[pending] = parts[k];
+                pending_node[pending ++] = children[k];
+            }
+            child_centroids[k] = subset_bounds[parts[k]].centroid();
+        }
+        BuildNode &build_node = nodes[node];
+        build_node.bounds = subset_bounds[s];
+        build_node.count = 0;
+        // the axis along which the children are furthest apart orders the traversal, which expects the left child on its
+        // low side like the splits of the builders
+        Vec3f separation = child_centroids[1] - child_centroids[0];
+        build_node.axis = 0;
+        for (int axis = 1; axis < 3; axis ++) {
+            if (fabsf(separation[axis]) > fabsf(separation[build_node.axis])) build_node.axis = axis;
+        }
+        bool swapped = separation[build_node.axis] < 0;
+        build_node.left = children[swapped ? 1 : 0];
+        build_node.right = children[swapped ? 0 : 1];
+        cost[node] = subset_cost[s];
+    }
+    return subset_cost[full];
+}
+
+int BVHBuilder::depth(int node) const
+{
+    if (nodes[node].left < 0) return 0;
+    return 1 + std::max(depth(nodes[node].left), depth(nodes[node].right));
+}
+
+int BVHBuilder::chunkCount(int count) const
+{
+    if (pool == NULL or pool->size() == 1 or count < 2 * PARALLEL_GRAIN) return 1;
+    return std::min(4 * pool->size(), count / PARALLEL_GRAIN);
+}
+
+void BVHBuilder::parallelFor(int count, const std::function<void(int, int, int)> &body, bool parallel) const
+{
+    int chunks = chunkCount(parallel ? count : 0);
+    if (chunks == 1) {
+        body(0, 0, count);
+        return;
+    }
+    pool->run(chunks, [&](int chunk, int) {
+        body(chunk, (long long)count * chunk / chunks, (long long)count * (chunk + 1) / chunks);
+    });
+}
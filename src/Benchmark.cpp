@@ -0,0 +1,151 @@
+#include "../include/Benchmark.h"
+#include "../include/Accelerator.h"
+#include "../include/Scene.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <dirent.h>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <sys/resource.h>
+
+struct BenchmarkResult
+{
+    std::string scene;
+    vector<double> parse_ms, build_ms, render_ms;
+    TraversalStats stats;
+    int threads;
+    long peak_rss_kb;
+    bool peak_rss_per_scene; // false if only the peak of the whole process is known
+};
+
+// the peak of the whole process so far, it never goes down
+static long peakResidentSetKb()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024; // bytes on macOS
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+// makes the kernel's high-water mark start again from the current resident set, possible on Linux 4.0 and later
+static bool resetPeakResidentSet()
+{
+    std::ofstream clear_refs("/proc/self/clear_refs");
+    clear_refs << "5" << std::flush;
+    return bool(clear_refs);
+}
+
+// the high-water mark since the last reset, 0 if it cannot be read
+static long scenePeakResidentSetKb()
+{
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0) return atol(line.c_str() + 6);
+    }
+    return 0;
+}
+
+static void writeTimes(std::ostream &out, const char *name, vector<double> times)
+{
+    std::sort(times.begin(), times.end());
+    double median = times.size() % 2 ? times[times.size() / 2] : (times[times.size() / 2 - 1] + times[times.size() / 2]) / 2;
+    out << "\"" << name << "\": {\"min\": " << times.front() << ", \"median\": " << median << "}";
+}
+
+static void writeJson(std::ostream &out, const RenderOptions &options, int repeats, const vector<BenchmarkResult> &results)
+{
+    out << "{\n  \"accelerator\": \"" << options.accelerator << "\",\n  \"builder\": \"" << options.builder << (options.treelets ? " + treelets" : "")
+        << "\",\n  \"trace\": \"" << options.trace
+        << "\",\n  \"sampling\": \"" << options.sampling
+        << "\",\n  \"simd\": \"" << blockKernels().name << "\",\n  \"repeats\": " << repeats << ",\n  \"scenes\": [";
+    for (size_t i = 0; i < results.size(); i ++) {
+        const BenchmarkResult &result = results[i];
+        // throughput uses the fastest render, ray counts are the same in every repetition
+        double seconds = *std::min_element(result.render_ms.begin(), result.render_ms.end()) / 1000.0;
+        double mrays = seconds > 0 ? 1e-6 / seconds : 0;
+        out << (i ? "," : "") << "\n    {\"scene\": \"" << result.scene << "\", \"threads\": " << result.threads << ",\n     ";
+        writeTimes(out, "parse_ms", result.parse_ms);
+        out << ", ";
+        writeTimes(out, "build_ms", result.build_ms);
+        out << ", ";
+        writeTimes(out, "render_ms", result.render_ms);
+        out << ",\n     \"rays\": {\"primary\": " << result.stats.primary_rays << ", \"shadow\": " << result.stats.shadow_rays
+            << ", \"reflection\": " << result.stats.reflection_rays << ", \"total\": " << result.stats.rays << "}"
+            << ",\n     \"traversal\": {\"hits\": " << result.stats.hits << ", \"nodes\": " << result.stats.nodes_visited
+            << ", \"triangle_tests\": " << result.stats.triangle_tests << ", \"sphere_tests\": " << result.stats.sphere_tests << "}"
+            << ",\n     \"mrays_per_second\": {\"primary\": " << result.stats.primary_rays * mrays
+            << ", \"shadow\": " << result.stats.shadow_rays * mrays << ", \"reflection\": " << result.stats.reflection_rays * mrays
+            << ", \"total\": " << result.stats.rays * mrays << "}"
+            << ",\n     \"" << (result.peak_rss_per_scene ? "peak_rss_kb" : "process_peak_rss_kb") << "\": " << result.peak_rss_kb << "}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+void runBenchmark(const RenderOptions &options, const std::string &directory, int repeats, const std::string &json_path)
+{
+    vector<std::string> files;
+    DIR *dir = opendir(directory.c_str());
+    if (dir == NULL) {
+        throw std::runtime_error("Error: The benchmark directory cannot be opened.");
+    }
+    while (struct dirent *entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name.size() > 4 and name.compare(name.size() - 4, 4, ".xml") == 0) {
+            files.push_back(name);
+        }
+    }
+    closedir(dir);
+    std::sort(files.begin(), files.end());
+
+    RenderOptions benchmarkOptions = options;
+    benchmarkOptions.write_images = false;
+    benchmarkOptions.quiet = true;
+    // parse times are measured on the xml itself, and benchmarking should not leave cache files in the scene directory
+    benchmarkOptions.scene_cache = false;
+
+    vector<BenchmarkResult> results;
+    for (size_t i = 0; i < files.size(); i ++) {
+        BenchmarkResult result;
+        result.scene = files[i];
+        result.peak_rss_per_scene = resetPeakResidentSet();
+        for (int r = 0; r < repeats; r ++) {
+            Accelerator::resetStats();
+            Scene scene;
+            scene.setOptions(benchmarkOptions);
+            auto start = std::chrono::high_resolution_clock::now();
+            scene.loadScene(directory + "/" + files[i]);
+            result.parse_ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+            scene.renderScene();
+            result.build_ms.push_back(scene.getBuildTime());
+            result.render_ms.push_back(scene.getRenderTime());
+            result.threads = scene.getThreadCount();
+            result.stats = Accelerator::totalStats();
+        }
+        // without a reset the high-water mark is the one of the whole process, which only grows from one scene to the next
+        result.peak_rss_kb = result.peak_rss_per_scene ? scenePeakResidentSetKb() : 0;
+        if (result.peak_rss_kb == 0) {
+            result.peak_rss_per_scene = false;
+            result.peak_rss_kb = peakResidentSetKb();
+        }
+        std::cerr << files[i] << ": render " << *std::min_element(result.render_ms.begin(), result.render_ms.end()) << " ms" << std::endl;
+        results.push_back(result);
+    }
+
+    if (json_path.empty()) {
+        writeJson(std::cout, options, repeats, results);
+    }
+    else {
+        std::ofstream out(json_path.c_str());
+        if (!out) {
+            throw std::runtime_error("Error: The benchmark output file cannot be opened for writing.");
+        }
+        writeJson(out, options, repeats, results);
+    }
+}
@@ -1,5 +1,14 @@
 #include "../include/Camera.h"
 #include "../include/basicTypeDefinition.h"
+#include "../include/Profiler.h"
+#include "../include/ToneMap.h"
+#include "../include/Wavefront.h"
+#include <cmath>
+#include <iostream>
+#include <sstream>
+
+#define TILE_SIZE 32
+#define ADAPTIVE_FIRST_PASS 4 // samples of every pixel before the adaptive mode decides which pixels get the rest
 
 Camera::Camera()
 {
@@ -11,6 +20,8 @@ Camera::Camera()
     this->image_width = 640;
     this->image_height = 480;
     this->image_name = "out";
+    this->num_samples = 1;
+    computeBasis();
 }
 
 Camera::Camera(Vec3f position, Vec3f gaze, Vec3f up, Vec4f near_plane, float near_distance, int image_width, int image_height, std::string image_name)
@@ -23,62 +34,300 @@ Camera::Camera(Vec3f position, Vec3f gaze, Vec3f up, Vec4f near_plane, float nea
     this->image_width = image_width;
     this->image_height = image_height;
     this->image_name = image_name;
-    this->imageData = new unsigned char[image_width * image_height * 3];
-    this->tracingRays = new Ray[image_width * image_height];
+    this->num_samples = 1;
+    this->framebuffer = new float[(size_t)image_width * image_height * 3];
+    computeBasis();
 }
 
 Camera::~Camera()
 {
-    if (imageData != nullptr) delete[] imageData;
-    if (tracingRays != nullptr) delete[] tracingRays;
+    if (framebuffer != nullptr) delete[] framebuffer;
+    if (heatmaps != nullptr) delete[] heatmaps;
+}
+
+int Camera::tileCount() const
+{
+    return ((image_width + TILE_SIZE - 1) / TILE_SIZE) * ((image_height + TILE_SIZE - 1) / TILE_SIZE);
 }
 
-void Camera::rayTrace(vector<Sphere> &spheres, vector<Face> &faces, Background &background)
+// hash of a pixel, a sample and a dimension in [0, 1), the jitter does not depend on which thread renders the tile
+static float sampleRandom(int x, int y, int sample, int dimension)
 {
-    int numThreads = 12;
-    vector<thread> threads;
-
-    for (int t = 0; t < numThreads; ++ t) {
-        threads.push_back(thread([&](int _t) {
-            Vec3i color;
-            int numOfRays = this->image_height * this->image_width;
-            Vec3i colorRay;
-
-            for (size_t i = _t; i < numOfRays; i += numThreads)
-            {
-                colorRay = tracingRays[i].computeColor(spheres, faces, background).clamp();
-                this->imageData[i * 3]     = colorRay.x;
-                this->imageData[i * 3 + 1] = colorRay.y;
-                this->imageData[i * 3 + 2] = colorRay.z;
+    unsigned int h = x * 0x8da6b343u ^ y * 0xd8163841u ^ sample * 0xcb1ab31fu ^ dimension * 0x165667b1u;
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return (h >> 8) * (1.0f / 16777216.0f);
+}
+
+static float luminance(const Vec3f &color)
+{
+    return 0.299f * fminf(fmaxf(color.x, 0), 255) + 0.587f * fminf(fmaxf(color.y, 0), 255) + 0.114f * fminf(fmaxf(color.z, 0), 255);
+}
+
+void Camera::renderTile(int tile, Accelerator &accelerator, const Background &background, const RenderOptions &options, int stride, bool refine)
+{
+    ScopedTimer timer("render tile", "tile", tile);
+    int tilesX = (image_width + TILE_SIZE - 1) / TILE_SIZE;
+    int x0 = (tile % tilesX) * TILE_SIZE, y0 = (tile / tilesX) * TILE_SIZE;
+    int x1 = min(x0 + TILE_SIZE, image_width), y1 = min(y0 + TILE_SIZE, image_height);
+    int width = x1 - x0, pixels = width * (y1 - y0);
+    // every thread keeps its buffers from tile to tile
+    static thread_local vector<PixelSample> samples;
+    static thread_local vector<Vec3f> colors, sums;
+    static thread_local vector<float> luminances, squares;
+    static thread_local vector<unsigned char> pending, selected;
+    static thread_local vector<float> costs, costSums;
+    sums.assign(pixels, Vec3f(0, 0, 0));
+    vector<float> *sampleCosts = heatmaps != nullptr ? &costs : NULL;
+    if (sampleCosts != NULL) costSums.assign(pixels * HEATMAP_COUNT, 0);
+
+    // every stride-th pixel in both directions, without those that the previous pass at twice the stride has traced already.
+    // Tiles start at multiples of every stride, so the grid is the same in all tiles
+    pending.assign(pixels, 0);
+    for (int y = y0; y < y1; y += stride) {
+        for (int x = x0; x < x1; x += stride) {
+            pending[(y - y0) * width + (x - x0)] = !(refine and x % (2 * stride) == 0 and y % (2 * stride) == 0);
+        }
+    }
+
+    // the adaptive mode looks at a few samples of every pixel first
+    bool adaptive = options.sampling == "adaptive" and num_samples > ADAPTIVE_FIRST_PASS;
+    int firstPass = adaptive ? ADAPTIVE_FIRST_PASS : num_samples;
+    samples.clear();
+    addSamples(x0, y0, x1, y1, pending, 0, firstPass, samples);
+    traceSamples(samples, accelerator, background, options.trace, colors, sampleCosts);
+    long long traced = samples.size();
+    luminances.assign(pixels, 0);
+    squares.assign(pixels, 0);
+    for (size_t i = 0; i < samples.size(); i++) {
+        int pixel = (samples[i].y - y0) * width + (samples[i].x - x0);
+        sums[pixel] = sums[pixel] + colors[i];
+        for (int k = 0; sampleCosts != NULL and k < HEATMAP_COUNT; k++) costSums[pixel * HEATMAP_COUNT + k] += costs[i * HEATMAP_COUNT + k];
+        float y = luminance(colors[i]);
+        luminances[pixel] += y;
+        squares[pixel] += y * y;
+    }
+
+    // the rest of the samples go to pixels whose samples disagree or that differ from a neighbour traced with them
+    selected.assign(pixels, 0);
+    if (adaptive) {
+        float threshold = options.adaptive_threshold;
+        for (int pixel = 0; pixel < pixels; pixel++) {
+            if (!pending[pixel]) continue;
+            float mean = luminances[pixel] / firstPass;
+            float variance = (squares[pixel] - luminances[pixel] * mean) / (firstPass - 1);
+            selected[pixel] = variance > threshold * threshold;
+        }
+        for (int y = y0; y < y1; y += stride) {
+            for (int x = x0; x < x1; x += stride) {
+                int pixel = (y - y0) * width + (x - x0);
+                if (!pending[pixel]) continue;
+                float mean = luminances[pixel] / firstPass;
+                int right = pixel + stride, below = pixel + stride * width;
+                if (x + stride < x1 and pending[right] and fabsf(luminances[right] / firstPass - mean) > threshold) {
+                    selected[pixel] = selected[right] = 1;
+                }
+                if (y + stride < y1 and pending[below] and fabsf(luminances[below] / firstPass - mean) > threshold) {
+                    selected[pixel] = selected[below] = 1;
+                }
             }
-        }, t));
+        }
+        samples.clear();
+        addSamples(x0, y0, x1, y1, selected, firstPass, num_samples - firstPass, samples);
+        traceSamples(samples, accelerator, background, options.trace, colors, sampleCosts);
+        traced += samples.size();
+        for (size_t i = 0; i < samples.size(); i++) {
+            int pixel = (samples[i].y - y0) * width + (samples[i].x - x0);
+            sums[pixel] = sums[pixel] + colors[i];
+            for (int k = 0; sampleCosts != NULL and k < HEATMAP_COUNT; k++) costSums[pixel * HEATMAP_COUNT + k] += costs[i * HEATMAP_COUNT + k];
+        }
     }
+    Accelerator::threadStats().primary_rays += traced;
 
-    for(auto& t: threads) {
-        t.join();
+    for (int y = y0; y < y1; y++) {
+        for (int x = x0; x < x1; x++) {
+            int pixel = (y - y0) * width + (x - x0);
+            float *out = this->framebuffer + ((size_t)y * image_width + x) * 3;
+            float *outCost = heatmaps != nullptr ? this->heatmaps + ((size_t)y * image_width + x) * HEATMAP_COUNT : NULL;
+            if (pending[pixel]) {
+                int count = selected[pixel] ? num_samples : firstPass;
+                Vec3f color = sums[pixel] / count;
+                out[0] = color.x;
+                out[1] = color.y;
+                out[2] = color.z;
+                for (int k = 0; outCost != NULL and k < HEATMAP_COUNT; k++) outCost[k] = costSums[pixel * HEATMAP_COUNT + k] / count;
+            }
+            else if (x % stride != 0 or y % stride != 0) { // upscaled from the traced pixel at the top left of its block
+                size_t source = (size_t)(y - y % stride) * image_width + (x - x % stride);
+                out[0] = this->framebuffer[source * 3];
+                out[1] = this->framebuffer[source * 3 + 1];
+                out[2] = this->framebuffer[source * 3 + 2];
+                for (int k = 0; outCost != NULL and k < HEATMAP_COUNT; k++) outCost[k] = this->heatmaps[source * HEATMAP_COUNT + k];
+            }
+        }
     }
 }
 
-void Camera::saveImage()
+void Camera::addSamples(int x0, int y0, int x1, int y1, const std::vector<unsigned char> &selected, int first, int count,
+                        std::vector<PixelSample> &samples) const
 {
-    write_ppm(this->image_name.c_str(), this->imageData, this->image_width, this->image_height);
+    // the samples of a pass are jittered inside a grid of at least count strata
+    int columns = ceil(sqrt((double)count)), rows = (count + columns - 1) / columns;
+    for (int by = y0; by < y1; by += PACKET_WIDTH) {
+        for (int bx = x0; bx < x1; bx += PACKET_WIDTH) {
+            for (int k = 0; k < count; k++) {
+                for (int lane = 0; lane < PACKET_SIZE; lane++) {
+                    int x = bx + lane % PACKET_WIDTH, y = by + lane / PACKET_WIDTH;
+                    if (x >= x1 or y >= y1) continue;
+                    if (!selected[(y - y0) * (x1 - x0) + (x - x0)]) continue;
+                    PixelSample sample;
+                    sample.x = x;
+                    sample.y = y;
+                    if (num_samples == 1) { // a single sample stays in the pixel's center
+                        sample.dx = sample.dy = 0.5f;
+                    }
+                    else {
+                        sample.dx = (k % columns + sampleRandom(x, y, first + k, 0)) / columns;
+                        sample.dy = (k / columns + sampleRandom(x, y, first + k, 1)) / rows;
+                    }
+                    samples.push_back(sample);
+                }
+            }
+        }
+    }
 }
 
-void Camera::computeTracingRays()
+void Camera::traceSamples(const std::vector<PixelSample> &samples, Accelerator &accelerator, const Background &background,
+                          const std::string &trace, std::vector<Vec3f> &colors, std::vector<float> *costs) const
 {
-    Vec3f v = up.normalize();
-    Vec3f w = Vec3f(-gaze.x, -gaze.y, -gaze.z).normalize();
-    Vec3f u = v.cross(w).normalize();
-    for (int i = 0; i < image_height; i++) {
-        for (int j = 0; j < image_width; j++) {
-            Vec3f m = position - w * near_distance;
-            Vec3f q = m + u * near_plane.l + v * near_plane.t;
-            float s_u = (near_plane.r - near_plane.l) * ((double)(j) + 0.5) / image_width;
-            float s_v = (near_plane.t - near_plane.b) * ((double)(i) + 0.5) / image_height;
-            Vec3f s = q + u * s_u - v * s_v;
-            Vec3f d = s - position;
-            d = d.normalize();
-            tracingRays[(image_height - i - 1) * image_width + j] = Ray(position, d);
+    static thread_local vector<Ray> rays;
+    int count = samples.size();
+    rays.resize(count);
+    colors.resize(count);
+    {
+        ScopedTimer timer("generate rays", "rays", count);
+        for (int i = 0; i < count; i++) {
+            rays[i] = generateRay(samples[i].x, samples[i].y, samples[i].dx, samples[i].dy);
         }
     }
+    ScopedTimer timer("trace rays", "rays", count);
+    if (costs != NULL) {
+        // the counters of the thread only tell the work of a sample apart when its rays are traced on their own
+        costs->resize(count * HEATMAP_COUNT);
+        TraversalStats &stats = Accelerator::threadStats();
+        for (int i = 0; i < count; i++) {
+            TraversalStats before = stats;
+            colors[i] = rays[i].computeColor(accelerator, background);
+            float *cost = costs->data() + i * HEATMAP_COUNT;
+            cost[0] = stats.nodes_visited - before.nodes_visited;
+            cost[1] = stats.primitiveTests() - before.primitiveTests();
+            cost[2] = stats.shadow_rays - before.shadow_rays;
+            cost[3] = rays[i].getDepth();
+        }
+    }
+    else if (trace == "wavefront") {
+        static thread_local Wavefront wavefront;
+        wavefront.trace(rays, accelerator, background, colors);
+    }
+    else if (trace == "packet") {
+        // primary rays of neighbouring pixels are found together, shading and secondary rays are traced one ray at a time
+        for (int first = 0; first < count; first += PACKET_SIZE) {
+            RayPacket packet;
+            int lanes = min(PACKET_SIZE, count - first);
+            for (int lane = 0; lane < lanes; lane++) {
+                packet.setRay(lane, rays[first + lane].getOrigin(), rays[first + lane].getDirection());
+            }
+            PacketHit hit;
+            accelerator.intersectPacket(packet, hit);
+            for (int lane = 0; lane < lanes; lane++) {
+                colors[first + lane] = rays[first + lane].computeColor(hit.primitive[lane], hit.t[lane], accelerator, background);
+            }
+        }
+    }
+    else {
+        for (int i = 0; i < count; i++) {
+            colors[i] = rays[i].computeColor(accelerator, background);
+        }
+    }
+}
+
+// the image name without its extension, the other outputs of a camera are named after it
+static std::string baseName(const std::string &image_name)
+{
+    size_t dot = image_name.rfind('.');
+    if (dot == std::string::npos or image_name.find('/', dot) != std::string::npos) return image_name;
+    return image_name.substr(0, dot);
+}
+
+void Camera::saveImage(const RenderOptions &options)
+{
+    ScopedTimer timer("save image");
+    // every output is derived from the same float framebuffer
+    int pixels = image_width * image_height;
+    vector<unsigned char> imageData((size_t)pixels * 3);
+    {
+        ScopedTimer toneMapTimer("tone map");
+        toneMap(this->framebuffer, pixels, options.tone_map, options.exposure, imageData.data());
+    }
+    const std::string &ppmFormat = this->ppm_format.empty() ? options.ppm_format : this->ppm_format;
+    write_ppm(this->image_name.c_str(), imageData.data(), this->image_width, this->image_height, ppmFormat != "P3");
+    if (options.write_pfm) {
+        write_pfm((baseName(this->image_name) + ".pfm").c_str(), this->framebuffer, this->image_width, this->image_height);
+    }
+    if (heatmaps == nullptr) return;
+
+    // false colors from black through blue, cyan, green and yellow to red for the most expensive pixel
+    static const char *names[HEATMAP_COUNT] = {"nodes", "primitives", "shadow", "depth"};
+    static const float ramp[6][3] = {{0, 0, 0}, {0, 0, 255}, {0, 255, 255}, {0, 255, 0}, {255, 255, 0}, {255, 0, 0}};
+    std::ostringstream scales;
+    for (int k = 0; k < HEATMAP_COUNT; k++) {
+        float maximum = 0;
+        for (int i = 0; i < pixels; i++) {
+            maximum = max(maximum, heatmaps[(size_t)i * HEATMAP_COUNT + k]);
+        }
+        for (int i = 0; i < pixels; i++) {
+            float x = maximum > 0 ? heatmaps[(size_t)i * HEATMAP_COUNT + k] / maximum * 5 : 0;
+            int stop = min(4, (int)x);
+            float f = x - stop;
+            for (int c = 0; c < 3; c++) {
+                imageData[(size_t)i * 3 + c] = (unsigned char)round(ramp[stop][c] + (ramp[stop + 1][c] - ramp[stop][c]) * f);
+            }
+        }
+        std::string name = baseName(this->image_name) + "_" + names[k] + ".ppm";
+        write_ppm(name.c_str(), imageData.data(), this->image_width, this->image_height, ppmFormat != "P3");
+        scales << (k ? ", " : "") << names[k] << " " << maximum;
+    }
+    if (!options.quiet) {
+        std::cout << "Heatmaps of " + this->image_name + ", red is per pixel " + scales.str() + "\n" << std::flush;
+    }
+}
+
+void Camera::enableHeatmaps()
+{
+    if (heatmaps == nullptr) heatmaps = new float[(size_t)image_width * image_height * HEATMAP_COUNT]();
+}
+
+void Camera::computeBasis()
+{
+    v = up.normalize();
+    Vec3f w = Vec3f(-gaze.x, -gaze.y, -gaze.z).normalize();
+    u = v.cross(w).normalize();
+    Vec3f m = position - w * near_distance;
+    q = m + u * near_plane.l + v * near_plane.t;
+    plane_width = near_plane.r - near_plane.l;
+    plane_height = near_plane.t - near_plane.b;
+}
+
+Ray Camera::generateRay(int x, int y, float dx, float dy) const
+{
+    // rows of the near plane are counted from q upwards while image rows go downwards
+    int i = image_height - y - 1;
+    // evaluated in double precision, accumulated float deltas would shift rays that fall exactly on shared triangle edges
+    float s_u = plane_width * ((double)(x) + dx) / image_width;
+    float s_v = plane_height * ((double)(i) + dy) / image_height;
+    Vec3f s = q + u * s_u - v * s_v;
+    return Ray(position, (s - position).normalize());
 }
@@ -0,0 +1,202 @@
+#include "../include/InstanceAccelerator.h"
+
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+
+#define TOP_LEAF_SIZE 2
+#define TOP_MAX_DEPTH 60 // keeps the traversal stack below its fixed size of 64
+
+InstanceAccelerator::InstanceAccelerator(const std::string &type, const BuildOptions &options)
+    : type(type), options(options), plain(Accelerator::create(type, options)), plain_primitives(0), build_time_ms(0)
+{
+}
+
+InstanceAccelerator::~InstanceAccelerator()
+{
+    delete plain;
+    for (size_t i = 0; i < meshes.size(); i ++) {
+        delete meshes[i];
+    }
+}
+
+int InstanceAccelerator::addMesh(const vector<Face> &faces)
+{
+    mesh_faces.push_back(faces);
+    return mesh_faces.size() - 1;
+}
+
+void InstanceAccelerator::addInstance(int mesh, const Transform &object_to_world, int material_id)
+{
+    Instance instance;
+    instance.to_world = object_to_world;
+    instance.to_object = object_to_world.inverse();
+    instance.identity = object_to_world.isIdentity();
+    instance.mesh = mesh;
+    instance.material_id = material_id;
+    instance.first_primitive = 0;
+    instances.push_back(instance);
+}
+
+void InstanceAccelerator::build(vector<Sphere> &spheres, vector<Face> &faces, const Background &background)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    plain->build(spheres, faces, background);
+    plain_primitives = spheres.size() + faces.size();
+
+    // every mesh is built once in its own coordinates, no matter how many instances it has
+    vector<AABB> mesh_bounds(mesh_faces.size());
+    for (size_t i = 0; i < mesh_faces.size(); i ++) {
+        for (size_t j = 0; j < mesh_faces[i].size(); j ++) {
+            const Face &face = mesh_faces[i][j];
+            mesh_bounds[i].expand(background.getVertex(face.v0_id - 1));
+            mesh_bounds[i].expand(background.getVertex(face.v1_id - 1));
+            mesh_bounds[i].expand(background.getVertex(face.v2_id - 1));
+        }
+        vector<Sphere> no_spheres;
+        meshes.push_back(Accelerator::create(type, options));
+        meshes.back()->build(no_spheres, mesh_faces[i], background);
+        mesh_triangles.push_back(mesh_faces[i].size());
+        vector<Face>().swap(mesh_faces[i]);
+    }
+
+    // the world bounds of an instance enclose the transformed corners of its mesh's bounds
+    long long next_primitive = plain_primitives;
+    vector<AABB> instance_bounds(instances.size());
+    for (size_t i = 0; i < instances.size(); i ++) {
+        Instance &instance = instances[i];
+        instance.first_primitive = next_primitive;
+        next_primitive += mesh_triangles[instance.mesh];
+        if (next_primitive > INT_MAX) throw std::runtime_error("Error: The mesh instances have too many triangles in total.");
+        const AABB &box = mesh_bounds[instance.mesh];
+        for (int corner = 0; corner < 8; corner ++) {
+            Vec3f p(corner & 1 ? box.max.x : box.min.x, corner & 2 ? box.max.y : box.min.y, corner & 4 ? box.max.z : box.min.z);
+            instance.bounds.expand(instance.to_world.point(p));
+        }
+        instance_bounds[i] = instance.bounds;
+    }
+    BVHBuilder builder(instance_bounds, TOP_LEAF_SIZE, TOP_MAX_DEPTH, options.pool);
+    builder.buildSAH();
+    top_nodes.swap(builder.nodes);
+    top_instances.swap(builder.primitive_ids);
+    build_time_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+int InstanceAccelerator::intersect(const Vec3f &origin, const Vec3f &direction, float &t, float t_max) const
+{
+    // the structures below count their own queries, but a ray that enters several instances is still one ray
+    TraversalStats &stats = threadStats();
+    unsigned long long rays = stats.rays;
+    int hit = plain->intersect(origin, direction, t, t_max);
+    if (!top_nodes.empty()) {
+        Vec3f inv_direction(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+        int stack[64];
+        int stack_size = 0;
+        int node_index = 0;
+        while (true) {
+            const BuildNode &node = top_nodes[node_index];
+            stats.nodes_visited ++;
+            if (node.bounds.intersect(origin, inv_direction, t) != INFINITY) {
+                if (node.left >= 0) { // visit the child on the far side of the split last
+                    bool far_left = inv_direction[node.axis] < 0;
+                    stack[stack_size ++] = far_left ? node.left : node.right;
+                    node_index = far_left ? node.right : node.left;
+                    continue;
+                }
+                for (int i = node.begin; i < node.begin + node.count; i ++) {
+                    const Instance &instance = instances[top_instances[i]];
+                    // t is a parameter along the ray, so distances in object space compare directly with world space ones. The mesh
+                    // is only searched up to the closest hit so far, one step past it so that exact ties still go to the lower id
+                    float t_instance, t_bound = std::nextafter(t, INFINITY);
+                    int primitive;
+                    if (instance.identity) primitive = meshes[instance.mesh]->intersect(origin, direction, t_instance, t_bound);
+                    else primitive = meshes[instance.mesh]->intersect(instance.to_object.point(origin), instance.to_object.vector(direction), t_instance, t_bound);
+                    if (primitive >= 0 and closerHit(t_instance, instance.first_primitive + primitive, t, hit)) {
+                        t = t_instance;
+                        hit = instance.first_primitive + primitive;
+                    }
+                }
+            }
+            if (stack_size == 0) break;
+            node_index = stack[-- stack_size];
+        }
+    }
+    stats.rays = rays + 1;
+    return hit;
+}
+
+bool InstanceAccelerator::occluded(const Vec3f &origin, const Vec3f &direction, float t_max) const
+{
+    TraversalStats &stats = threadStats();
+    unsigned long long rays = stats.rays;
+    bool hit = plain->occluded(origin, direction, t_max);
+    if (!hit and !top_nodes.empty()) {
+        Vec3f inv_direction(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+        int stack[64];
+        int stack_size = 0;
+        stack[stack_size ++] = 0;
+        while (stack_size > 0 and !hit) {
+            const BuildNode &node = top_nodes[stack[-- stack_size]];
+            stats.nodes_visited ++;
+            if (node.bounds.intersect(origin, inv_direction, t_max) == INFINITY) continue;
+            if (node.left >= 0) { // any hit terminates the query, so the children are not ordered
+                stack[stack_size ++] = node.right;
+                stack[stack_size ++] = node.left;
+                continue;
+            }
+            for (int i = node.begin; i < node.begin + node.count and !hit; i ++) {
+                const Instance &instance = instances[top_instances[i]];
+                if (instance.identity) hit = meshes[instance.mesh]->occluded(origin, direction, t_max);
+                else hit = meshes[instance.mesh]->occluded(instance.to_object.point(origin), instance.to_object.vector(direction), t_max);
+            }
+        }
+    }
+    stats.rays = rays + 1;
+    return hit;
+}
+
+int InstanceAccelerator::findInstance(int primitive) const
+{
+    int first = 0, last = instances.size();
+    while (last - first > 1) {
+        int middle = (first + last) / 2;
+        if (instances[middle].first_primitive <= primitive) first = middle;
+        else last = middle;
+    }
+    return first;
+}
+
+void InstanceAccelerator::surfaceAt(int primitive, const Vec3f &point, Vec3f &normal, int &material_id) const
+{
+    if (primitive < plain_primitives) {
+        plain->surfaceAt(primitive, point, normal, material_id);
+        return;
+    }
+    const Instance &instance = instances[findInstance(primitive)];
+    int mesh_material_id;
+    if (instance.identity) {
+        meshes[instance.mesh]->surfaceAt(primitive - instance.first_primitive, point, normal, mesh_material_id);
+    }
+    else {
+        Vec3f object_normal;
+        meshes[instance.mesh]->surfaceAt(primitive - instance.first_primitive, instance.to_object.point(point), object_normal, mesh_material_id);
+        normal = instance.to_object.normal(object_normal).normalize();
+    }
+    material_id = instance.material_id;
+}
+
+void InstanceAccelerator::printBuildStats() const
+{
+    if (plain_primitives > 0) plain->printBuildStats();
+    long long stored = 0, placed = 0;
+    for (size_t i = 0; i < mesh_triangles.size(); i ++) {
+        stored += mesh_triangles[i];
+    }
+    for (size_t i = 0; i < instances.size(); i ++) {
+        placed += mesh_triangles[instances[i].mesh];
+    }
+    std::cout << "Instances: " << instances.size() << " instances of " << meshes.size() << " meshes, " << stored << " triangles stored for "
+              << placed << " placed, top level with " << top_nodes.size() << " nodes, built in " << build_time_ms << " ms" << std::endl;
+}
@@ -0,0 +1,95 @@
+#include "../include/PrimitiveBlock.h"
+#include "../include/Simd.h"
+
+#include <stdexcept>
+
+static Vec3f4 loadRows(const PrimitiveBlock &block, int row, int lane)
+{
+    return Vec3f4(Float4::load(block.rows[row] + lane), Float4::load(block.rows[row + 1] + lane), Float4::load(block.rows[row + 2] + lane));
+}
+
+// distances of the four lanes starting at lane, -1 for misses
+static Float4 intersectLanes(const PrimitiveBlock &block, int lane, const Vec3f4 &origin, const Vec3f4 &direction)
+{
+    if (block.is_sphere) return sphereIntersectionLanes(origin, direction, loadRows(block, 0, lane), Float4::load(block.rows[3] + lane));
+    return faceIntersectionLanes(origin, direction, loadRows(block, 0, lane), loadRows(block, 3, lane), loadRows(block, 6, lane));
+}
+
+static void intersectBlock4(const PrimitiveBlock &block, const float *origin, const float *direction, float &t, int &hit)
+{
+    Vec3f4 o(origin[0], origin[1], origin[2]), d(direction[0], direction[1], direction[2]);
+    for (int lane = 0; lane < block.count; lane += 4) {
+        Float4 t_lanes = intersectLanes(block, lane, o, d);
+        int closer = ((t_lanes > Float4(0.0f)) & (t_lanes <= Float4(t))).bits() & ((1 << (block.count - lane)) - 1);
+        if (closer == 0) continue;
+        alignas(16) float t_primitive[4];
+        t_lanes.store(t_primitive);
+        for (int i = 0; i < 4; i ++) {
+            int primitive = block.primitive[lane + i];
+            // t may have changed for an earlier lane, so the candidates are checked again one by one
+            if ((closer & (1 << i)) and (t_primitive[i] < t or (t_primitive[i] == t and primitive < hit))) {
+                t = t_primitive[i];
+                hit = primitive;
+            }
+        }
+    }
+}
+
+static bool occludedBlock4(const PrimitiveBlock &block, const float *origin, const float *direction, float t_max)
+{
+    Vec3f4 o(origin[0], origin[1], origin[2]), d(direction[0], direction[1], direction[2]);
+    for (int lane = 0; lane < block.count; lane += 4) {
+        Float4 t_lanes = intersectLanes(block, lane, o, d);
+        if (((t_lanes > Float4(0.0f)) & (t_lanes < Float4(t_max))).bits() & ((1 << (block.count - lane)) - 1)) return true;
+    }
+    return false;
+}
+
+#if defined(__SSE2__)
+static const BlockKernels kernels4 = {"sse", 4, intersectBlock4, occludedBlock4};
+#else
+static const BlockKernels kernels4 = {"scalar", 4, intersectBlock4, occludedBlock4};
+#endif
+#if defined(__x86_64__) or defined(__i386__)
+static const BlockKernels kernels8 = {"avx2", 8, intersectBlockAvx2, occludedBlockAvx2};
+#endif
+static const BlockKernels *selected_kernels = &kernels4;
+
+static bool hasAvx2()
+{
+#if defined(__x86_64__) or defined(__i386__)
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+
+void selectBlockKernels(const std::string &name)
+{
+    if (name == "auto") {
+        selected_kernels = &kernels4;
+#if defined(__x86_64__) or defined(__i386__)
+        if (hasAvx2()) selected_kernels = &kernels8;
+#endif
+    }
+    else if (name == "avx2") {
+#if defined(__x86_64__) or defined(__i386__)
+        if (hasAvx2()) {
+            selected_kernels = &kernels8;
+            return;
+        }
+#endif
+        throw std::runtime_error("Error: This processor does not support AVX2.");
+    }
+    else if (name == "sse" or name == kernels4.name) {
+        selected_kernels = &kernels4;
+    }
+    else {
+        throw std::runtime_error("Error: Unknown SIMD kernels \"" + name + "\", expected auto, avx2 or sse.");
+    }
+}
+
+const BlockKernels &blockKernels()
+{
+    return *selected_kernels;
+}
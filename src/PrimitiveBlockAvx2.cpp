@@ -0,0 +1,109 @@
+// AVX2 versions of the block kernels. This file is compiled with AVX2 enabled, so it must not include headers with
+// inline functions that other files also use: the linker could keep the AVX2 copy and break older processors.
+#if defined(__x86_64__) or defined(__i386__)
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2"))), apply_to = function)
+#else
+#pragma GCC target("avx2")
+#endif
+
+#include <immintrin.h>
+#include "../include/PrimitiveBlock.h"
+#include "../include/LaneMath.h"
+
+namespace {
+
+class Mask8
+{
+public:
+    __m256 v;
+    explicit Mask8(__m256 v) : v(v) {}
+    int bits() const {return _mm256_movemask_ps(v);}
+    Mask8 operator&(const Mask8 &m) const {return Mask8(_mm256_and_ps(v, m.v));}
+};
+
+class Float8
+{
+public:
+    __m256 v;
+    Float8() {}
+    Float8(float f) : v(_mm256_set1_ps(f)) {}
+    explicit Float8(__m256 v) : v(v) {}
+    static Float8 load(const float *p) {return Float8(_mm256_loadu_ps(p));}
+    void store(float *p) const {_mm256_storeu_ps(p, v);}
+    Float8 operator+(const Float8 &f) const {return Float8(_mm256_add_ps(v, f.v));}
+    Float8 operator-(const Float8 &f) const {return Float8(_mm256_sub_ps(v, f.v));}
+    Float8 operator*(const Float8 &f) const {return Float8(_mm256_mul_ps(v, f.v));}
+    Float8 operator/(const Float8 &f) const {return Float8(_mm256_div_ps(v, f.v));}
+    Float8 operator-() const {return Float8(_mm256_xor_ps(v, _mm256_set1_ps(-0.0f)));}
+    Mask8 operator<(const Float8 &f) const {return Mask8(_mm256_cmp_ps(v, f.v, _CMP_LT_OQ));}
+    Mask8 operator<=(const Float8 &f) const {return Mask8(_mm256_cmp_ps(v, f.v, _CMP_LE_OQ));}
+    Mask8 operator>(const Float8 &f) const {return Mask8(_mm256_cmp_ps(v, f.v, _CMP_GT_OQ));}
+    Mask8 operator>=(const Float8 &f) const {return Mask8(_mm256_cmp_ps(v, f.v, _CMP_GE_OQ));}
+};
+
+Float8 sqrt(const Float8 &f) {return Float8(_mm256_sqrt_ps(f.v));}
+Float8 abs(const Float8 &f) {return Float8(_mm256_andnot_ps(_mm256_set1_ps(-0.0f), f.v));}
+Float8 select(const Mask8 &m, const Float8 &a, const Float8 &b) {return Float8(_mm256_blendv_ps(b.v, a.v, m.v));}
+
+typedef Vec3Lanes<Float8> Vec3f8;
+
+Vec3f8 loadRows(const PrimitiveBlock &block, int row)
+{
+    return Vec3f8(Float8::load(block.rows[row]), Float8::load(block.rows[row + 1]), Float8::load(block.rows[row + 2]));
+}
+
+Float8 intersectLanes(const PrimitiveBlock &block, const float *origin, const float *direction)
+{
+    Vec3f8 o(origin[0], origin[1], origin[2]), d(direction[0], direction[1], direction[2]);
+    if (block.is_sphere) return sphereIntersectionLanes(o, d, loadRows(block, 0), Float8::load(block.rows[3]));
+    return faceIntersectionLanes(o, d, loadRows(block, 0), loadRows(block, 3), loadRows(block, 6));
+}
+
+}
+
+void intersectBlockAvx2(const PrimitiveBlock &block, const float *origin, const float *direction, float &t, int &hit)
+{
+    Float8 t_lanes = intersectLanes(block, origin, direction);
+    int closer = ((t_lanes > Float8(0.0f)) & (t_lanes <= Float8(t))).bits() & ((1 << block.count) - 1);
+    if (closer == 0) return;
+    float t_primitive[8];
+    t_lanes.store(t_primitive);
+    for (int i = 0; i < block.count; i ++) {
+        int primitive = block.primitive[i];
+        if ((closer & (1 << i)) and (t_primitive[i] < t or (t_primitive[i] == t and primitive < hit))) {
+            t = t_primitive[i];
+            hit = primitive;
+        }
+    }
+}
+
+bool occludedBlockAvx2(const PrimitiveBlock &block, const float *origin, const float *direction, float t_max)
+{
+    Float8 t_lanes = intersectLanes(block, origin, direction);
+    return ((t_lanes > Float8(0.0f)) & (t_lanes < Float8(t_max))).bits() & ((1 << block.count) - 1);
+}
+
+int intersectBoxesAvx2(const float (*bounds)[8], const float *origin, const float *inv_direction, float t_max, float *t_near)
+{
+    // the operations of the four wide child test in WideBVH.cpp, so the distances are the same
+    Float8 t0(0.0f), t1(t_max * 1.0000004f);
+    for (int axis = 0; axis < 3; axis ++) {
+        Float8 t_min_axis = (Float8::load(bounds[axis]) - Float8(origin[axis])) * Float8(inv_direction[axis]);
+        Float8 t_max_axis = (Float8::load(bounds[3 + axis]) - Float8(origin[axis])) * Float8(inv_direction[axis]);
+        Mask8 swap = t_min_axis > t_max_axis;
+        Float8 t_entry = select(swap, t_max_axis, t_min_axis);
+        Float8 t_exit = select(swap, t_min_axis, t_max_axis) * Float8(1.0000004f);
+        t0 = select(t_entry > t0, t_entry, t0);
+        t1 = select(t_exit < t1, t_exit, t1);
+    }
+    t0.store(t_near);
+    return (t0 <= t1).bits();
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#endif
+
+#endif
@@ -0,0 +1,81 @@
+#include "../include/Profiler.h"
+
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    struct Event
+    {
+        const char *name;
+        const char *arg_name;
+        int arg;
+        std::chrono::steady_clock::time_point start, end;
+    };
+
+    // events of one thread, only that thread appends to it so recording takes no lock
+    struct ThreadEvents
+    {
+        int thread;
+        bool main;
+        std::vector<Event> events;
+    };
+
+    std::chrono::steady_clock::time_point origin;
+    std::thread::id main_thread;
+    std::mutex threads_mutex;
+    std::vector<ThreadEvents *> threads; // kept until the process ends, threads may finish before the trace is written
+    thread_local ThreadEvents *thread_events = NULL;
+}
+
+bool Profiler::enabled = false;
+
+void Profiler::enable()
+{
+    origin = std::chrono::steady_clock::now();
+    main_thread = std::this_thread::get_id();
+    enabled = true;
+}
+
+void Profiler::record(const char *name, const char *arg_name, int arg, std::chrono::steady_clock::time_point start,
+                      std::chrono::steady_clock::time_point end)
+{
+    if (thread_events == NULL) {
+        std::lock_guard<std::mutex> lock(threads_mutex);
+        thread_events = new ThreadEvents();
+        thread_events->thread = threads.size();
+        thread_events->main = std::this_thread::get_id() == main_thread;
+        threads.push_back(thread_events);
+    }
+    Event event = {name, arg_name, arg, start, end};
+    thread_events->events.push_back(event);
+}
+
+void Profiler::write(const std::string &filename)
+{
+    std::ofstream out(filename.c_str());
+    if (!out) throw std::runtime_error("Error: The trace file cannot be opened for writing.");
+    std::lock_guard<std::mutex> lock(threads_mutex);
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+    for (size_t i = 0; i < threads.size(); i ++) {
+        out << (i ? "," : "") << "\n{\"ph\": \"M\", \"pid\": 1, \"tid\": " << threads[i]->thread << ", \"name\": \"thread_name\", \"args\": {\"name\": \"";
+        if (threads[i]->main) out << "main";
+        else out << "worker " << threads[i]->thread;
+        out << "\"}}";
+        // events are recorded when their scope ends, the order within a thread does not matter to the viewers
+        const std::vector<Event> &events = threads[i]->events;
+        for (size_t j = 0; j < events.size(); j ++) {
+            const Event &event = events[j];
+            out << ",\n{\"ph\": \"X\", \"pid\": 1, \"tid\": " << threads[i]->thread << ", \"name\": \"" << event.name << "\", \"ts\": "
+                << std::chrono::duration<double, std::micro>(event.start - origin).count() << ", \"dur\": "
+                << std::chrono::duration<double, std::micro>(event.end - event.start).count();
+            if (event.arg_name != NULL) out << ", \"args\": {\"" << event.arg_name << "\": " << event.arg << "}";
+            out << "}";
+        }
+    }
+    out << "\n]}\n";
+    if (!out) throw std::runtime_error("Error: The trace file cannot be written.");
+}
@@ -14,51 +14,35 @@ Ray::Ray(Vec3f origin, Vec3f direction)
     this->hit_record.normal = Vec3f(0, 0, 0);
 }
 
-bool Ray::closestIntersection(vector<Sphere> &spheres, vector<Face> &faces, Background &background) {
-    for (int i = 0; i < spheres.size(); i ++) {
-        // update ray's hit record
-        float t = calculateSphereIntersection(spheres[i], background);
-        if (t > 0 and (hit_record.t < 0 or t < hit_record.t)) {
-            hit_record.t = t;
-            hit_record.material_id = spheres[i].material_id;
-            hit_record.material = background.getMaterial(hit_record.material_id-1);
-            hit_record.intersection_point = origin + direction * hit_record.t;
-            hit_record.normal = 
-                (hit_record.intersection_point - background.getVertex(spheres[i].center_vertex_id-1)).normalize();
-        }
-    }
-    for (int i = 0; i < faces.size(); i ++) {
-        // update ray's hit record
-        float t = calculateFaceIntersection(faces[i], background);
-        if (t > 0 and (hit_record.t < 0 or t < hit_record.t)) {
-            hit_record.t = t;
-            hit_record.material_id = faces[i].material_id;
-            hit_record.material = background.getMaterial(hit_record.material_id-1);
-            hit_record.normal = faces[i].normal;
-        }
-    }
-    if (hit_record.t > 0) {
-        hit_record.intersection_point = origin + direction * hit_record.t;
-        return true;
+bool Ray::closestIntersection(Accelerator &accelerator, const Background &background) {
+    float t;
+    int primitive = accelerator.intersect(origin, direction, t);
+    return recordHit(primitive, t, accelerator, background);
+}
+
+bool Ray::recordHit(int primitive, float t, Accelerator &accelerator, const Background &background) {
+    if (primitive < 0) {
+        return false;
     }
-    return false;
+    Accelerator::threadStats().hits ++;
+    // update ray's hit record
+    hit_record.t = t;
+    hit_record.intersection_point = origin + direction * hit_record.t;
+    accelerator.surfaceAt(primitive, hit_record.intersection_point, hit_record.normal, hit_record.material_id);
+    hit_record.material = &background.getMaterial(hit_record.material_id-1);
+    return true;
 }
 
-float Ray::calculateFaceIntersection(Face &face, Background &background)
+float Ray::calculateFaceIntersection(const Vec3f &origin, const Vec3f &direction, const TriangleRecord &triangle)
 {
-    Vec3f vertex1 = background.getVertex(face.v0_id-1);
-    Vec3f vertex2 = background.getVertex(face.v1_id-1);
-    Vec3f vertex3 = background.getVertex(face.v2_id-1);
-    face.calculateNormal(vertex1, vertex2, vertex3);
-    Vec3f edge1 = vertex2 - vertex1;
-    Vec3f edge2 = vertex3 - vertex1;
-    Vec3f triangleNormal = edge1.cross(edge2);
+    const Vec3f &edge1 = triangle.edge1;
+    const Vec3f &edge2 = triangle.edge2;
     Vec3f h = direction.cross(edge2);
     float determinantA = edge1.dot(h);
     float t = -1;
     if (determinantA > -EPS and determinantA < EPS) return t;
     float f = 1.0 / determinantA;
-    Vec3f s = (origin - vertex1);
+    Vec3f s = (origin - triangle.v0);
     float u = f * s.dot(h);
     if (u < 0.0 or u > 1.0) return t;
     Vec3f q = s.cross(edge1);
@@ -69,14 +53,14 @@ float Ray::calculateFaceIntersection(Face &face, Background &background)
     return t;
 }
 
-float Ray::calculateSphereIntersection(Sphere &sphere, Background &background)
+float Ray::calculateSphereIntersection(const Vec3f &origin, const Vec3f &direction, const SphereRecord &sphere)
 {
-    Vec3f center = background.getVertex(sphere.center_vertex_id-1);
+    const Vec3f &center = sphere.center;
     float t = -1;
     // calculate the coefficients for the quadratic equation
     float a = direction.dot(direction);
     float b = direction.dot(origin - center);
-    float c = (origin - center).dot(origin - center) - sphere.radius*sphere.radius;
+    float c = (origin - center).dot(origin - center) - sphere.radius_squared;
     
     float discriminant = b*b - a*c;
 
@@ -93,64 +77,125 @@ float Ray::calculateSphereIntersection(Sphere &sphere, Background &background)
     return t;
 }
 
-bool Ray::isInShadow (const PointLight &light, vector<Sphere> &spheres, vector<Face> &faces, Background &background) {
-    Vec3f shadowRayDirection = (light.position - hit_record.intersection_point).normalize();
-    Ray shadowRay(hit_record.intersection_point + hit_record.normal*(background.getShadowRayEpsilon()), shadowRayDirection);
+// the float equivalents of the double constants of calculateFaceIntersection, shared by all lane kernels
+static float floatBelow(double threshold)
+{
+    float f = threshold;
+    return f >= threshold ? f : nextafterf(f, INFINITY);
+}
+const float face_determinant_epsilon = floatBelow(EPS);
+const float face_min_distance = floatBelow(1e-6);
 
-    // here we want to proceed through all of the objects and find whether there is an intersection or not
-    if (shadowRay.closestIntersection(spheres, faces, background)) { // there is an object in the direction of the ray
-        float tLight = (light.position.x - shadowRay.origin.x) / shadowRay.direction.x;
-        if (shadowRay.hit_record.t < tLight) return true; // the object is between the intersection point and light
-    }
-    
-    // no intersection with objects; the point is in the light
-    return false;
+Float4 Ray::calculateFaceIntersection(const Vec3f4 &origin, const Vec3f4 &direction, const TriangleRecord &triangle)
+{
+    return faceIntersectionLanes(origin, direction, Vec3f4(triangle.v0.x, triangle.v0.y, triangle.v0.z),
+                                 Vec3f4(triangle.edge1.x, triangle.edge1.y, triangle.edge1.z), Vec3f4(triangle.edge2.x, triangle.edge2.y, triangle.edge2.z));
 }
 
-Vec3f Ray::computeColor(vector<Sphere> &spheres, vector<Face> &faces, Background &background)
+Float4 Ray::calculateSphereIntersection(const Vec3f4 &origin, const Vec3f4 &direction, const SphereRecord &sphere)
 {
-    if (depth > background.getMaxRecursionDepth()) { // max depth exceeded
-        return Vec3f(0, 0, 0);
-    }
-    if (closestIntersection(spheres, faces, background)) { // find the color at the closest hit point
-        return applyShading(spheres, faces, background);
-    }
-    else if (depth == 0) { // no intersection for the primary ray
-        return Vec3f(background.getBackgroundColor().x, background.getBackgroundColor().y, background.getBackgroundColor().z);
-    }
-    else { // avoid repeated addition of the background color for reflected rays
-        return Vec3f(0, 0, 0);
+    return sphereIntersectionLanes(origin, direction, Vec3f4(sphere.center.x, sphere.center.y, sphere.center.z), Float4(sphere.radius_squared));
+}
+
+bool Ray::occluded(const Vec3f &origin, const Vec3f &direction, float t_max, Accelerator &accelerator)
+{
+    TraversalStats &stats = Accelerator::threadStats();
+    stats.shadow_rays ++;
+    bool blocked = accelerator.occluded(origin, direction, t_max);
+    stats.hits += blocked;
+    return blocked;
+}
+
+Vec3f Ray::computeColor(Accelerator &accelerator, const Background &background)
+{
+    float t;
+    int primitive = accelerator.intersect(origin, direction, t);
+    return computeColor(primitive, t, accelerator, background);
+}
+
+Vec3f Ray::computeColor(int primitive, float t, Accelerator &accelerator, const Background &background)
+{
+    // every mirror bounce adds its shading weighted by the product of the mirror reflectances on the way there
+    Vec3f color(0, 0, 0);
+    Vec3f throughput(1, 1, 1);
+    while (true) {
+        if (!recordHit(primitive, t, accelerator, background)) {
+            if (depth == 0) { // no intersection for the primary ray, reflected rays that miss add nothing
+                color = Vec3f(background.getBackgroundColor().x, background.getBackgroundColor().y, background.getBackgroundColor().z);
+            }
+            return color;
+        }
+        color = color + applyShading(accelerator, background) * throughput;
+        if (!reflectionWeight(throughput, background)) {
+            return color;
+        }
+        // the reflected ray continues as this ray
+        reflect(background);
+        Accelerator::threadStats().reflection_rays ++;
+        primitive = accelerator.intersect(origin, direction, t);
     }
 }
 
-Vec3f Ray::applyShading(vector<Sphere> &spheres, vector<Face> &faces, Background &background) {
-    Vec3f color = background.getAmbientLight() * hit_record.material.ambient;
-    if (hit_record.material.is_mirror) {
-        Ray reflectionRay(hit_record.intersection_point + hit_record.normal*(background.getShadowRayEpsilon()), (direction - hit_record.normal * 2.0f * direction.dot(hit_record.normal)).normalize());
-        reflectionRay.depth = depth + 1;
-        color = color + reflectionRay.computeColor(spheres, faces, background) * hit_record.material.mirror;
+bool Ray::reflectionWeight(Vec3f &throughput, const Background &background) const
+{
+    const Material &material = *hit_record.material;
+    if (!material.is_mirror or depth + 1 > background.getMaxRecursionDepth()) {
+        return false;
     }
-    int numOfLights = background.getPointLights().size();
+    throughput = throughput * material.mirror;
+    float min_throughput = background.getMinThroughput();
+    return throughput.x > min_throughput or throughput.y > min_throughput or throughput.z > min_throughput;
+}
+
+void Ray::reflect(const Background &background)
+{
+    origin = hit_record.intersection_point + hit_record.normal*(background.getShadowRayEpsilon());
+    direction = (direction - hit_record.normal * 2.0f * direction.dot(hit_record.normal)).normalize();
+    depth ++;
+}
+
+Vec3f Ray::applyShading(Accelerator &accelerator, const Background &background) {
+    const vector<PointLight> &pointLights = background.getPointLights();
+    Vec3f color = background.getAmbientLight() * hit_record.material->ambient;
+    int numOfLights = pointLights.size();
     for (int i = 0; i < numOfLights; i ++) {
-        if (isInShadow(background.getPointLights()[i], spheres, faces, background)) {
+        const PointLight &light = pointLights[i];
+        // the point is in shadow if any object lies between it and the light
+        Vec3f shadowRayOrigin, shadowRayDirection;
+        float tLight;
+        shadowRay(light, background, shadowRayOrigin, shadowRayDirection, tLight);
+        if (occluded(shadowRayOrigin, shadowRayDirection, tLight, accelerator)) {
             continue;
         }
-        Vec3f lightDirection = background.getPointLights()[i].position - hit_record.intersection_point;
-        lightDirection = lightDirection.normalize();
-        float diffuse = lightDirection.dot(hit_record.normal);
-        if (diffuse < 0) {
-            diffuse = 0;
-        }
-        Vec3f specularDirection = lightDirection - direction;
-        specularDirection = specularDirection.normalize();
-        float specular = specularDirection.dot(hit_record.normal);
-        if (specular < 0) {
-            specular = 0;
-        }
-        specular = pow(specular, hit_record.material.phong_exponent);
-
-        float lightDistance = (background.getPointLights()[i].position - hit_record.intersection_point).length();
-        color = color + background.getPointLights()[i].intensity / (lightDistance*lightDistance) * (hit_record.material.diffuse * diffuse + hit_record.material.specular * specular);
+        color = color + lightContribution(light);
     }
     return color;
-}
\ No newline at end of file
+}
+
+void Ray::shadowRay(const PointLight &light, const Background &background, Vec3f &shadow_origin, Vec3f &shadow_direction, float &t_light) const
+{
+    shadow_origin = hit_record.intersection_point + hit_record.normal*(background.getShadowRayEpsilon());
+    shadow_direction = (light.position - hit_record.intersection_point).normalize();
+    t_light = (light.position - shadow_origin).length();
+}
+
+Vec3f Ray::lightContribution(const PointLight &light) const
+{
+    const Material &material = *hit_record.material;
+    Vec3f lightDirection = light.position - hit_record.intersection_point;
+    lightDirection = lightDirection.normalize();
+    float diffuse = lightDirection.dot(hit_record.normal);
+    if (diffuse < 0) {
+        diffuse = 0;
+    }
+    Vec3f specularDirection = lightDirection - direction;
+    specularDirection = specularDirection.normalize();
+    float specular = specularDirection.dot(hit_record.normal);
+    if (specular < 0) {
+        specular = 0;
+    }
+    specular = pow(specular, material.phong_exponent);
+
+    float lightDistance = (light.position - hit_record.intersection_point).length();
+    return light.intensity / (lightDistance*lightDistance) * (material.diffuse * diffuse + material.specular * specular);
+}
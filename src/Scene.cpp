@@ -1,5 +1,16 @@
 #include "../include/Scene.h"
 #include "../include/Camera.h"
+#include "../include/Accelerator.h"
+#include "../include/InstanceAccelerator.h"
+#include "../include/Profiler.h"
+#include "../include/ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+
+#define PROGRESSIVE_FIRST_STRIDE 8 // the first progressive pass traces one pixel of every 8x8 block
 
 using namespace std;
 Scene::Scene()
@@ -13,33 +24,80 @@ Scene::Scene()
     this->materials = std::vector<Material>();
     this->vertex_data = std::vector<Vec3f>();
     this->meshes = std::vector<Mesh>();
+    this->mesh_instances = std::vector<MeshInstance>();
     this->triangles = std::vector<Triangle>();
     this->spheres = std::vector<Sphere>();
+    this->build_time_ms = 0;
+    this->render_time_ms = 0;
+    this->thread_count = 0;
 }
 
 void Scene::renderScene()
 {
-    Background background(this->background_color, this->ambient_light, this->point_lights, this->vertex_data, this->max_recursion_depth, this->materials, this->shadow_ray_epsilon);
+    auto buildStart = std::chrono::high_resolution_clock::now();
+    Background background(this->background_color, this->ambient_light, this->point_lights, this->vertex_data, this->max_recursion_depth, this->materials, this->shadow_ray_epsilon,
+                          options.min_throughput);
     // this method will go over all the cameras in the scene and render image from each camera
     int size = this->cameras.size();
     // combine all the objects in the scene in a new vector of objects
     vector<Sphere> spheres;
     vector<Face> faces;
-    for (size_t i = 0; i < this->meshes.size(); i++) {
-        for (int j = 0; j < this->meshes[i].faces.size(); j ++) {
-            this->meshes[i].faces[j].material_id = this->meshes[i].material_id;
-            faces.push_back((this->meshes[i].faces[j]));
+    // meshes that have instances are stored once and placed by an instance each, including where they were defined
+    vector<bool> instanced(this->meshes.size(), false);
+    {
+        ScopedTimer timer("flatten geometry");
+        for (size_t i = 0; i < this->mesh_instances.size(); i++) {
+            instanced[this->mesh_instances[i].base_mesh] = true;
+        }
+        for (size_t i = 0; i < this->meshes.size(); i++) {
+            if (instanced[i]) continue;
+            for (int j = 0; j < this->meshes[i].faces.size(); j ++) {
+                this->meshes[i].faces[j].material_id = this->meshes[i].material_id;
+                faces.push_back((this->meshes[i].faces[j]));
+            }
+        }
+        for (size_t i = 0; i < this->triangles.size(); i++) {
+            triangles[i].face.material_id = triangles[i].material_id;
+            faces.push_back((this->triangles[i].face));
+        }
+        for (size_t i = 0; i < this->spheres.size(); i++) {
+            spheres.push_back((this->spheres[i]));
         }
     }
-    for (size_t i = 0; i < this->triangles.size(); i++) {
-        triangles[i].face.material_id = triangles[i].material_id;
-        faces.push_back((this->triangles[i].face));
+    // all ray queries go through the acceleration structure built over the combined objects, its build already uses the render threads
+    ThreadPool pool(options.threads);
+    thread_count = pool.size();
+    selectBlockKernels(options.simd);
+    BuildOptions buildOptions;
+    buildOptions.builder = options.builder;
+    buildOptions.treelets = options.treelets;
+    buildOptions.pool = &pool;
+    Accelerator *accelerator;
+    if (this->mesh_instances.empty()) {
+        accelerator = Accelerator::create(options.accelerator, buildOptions);
     }
-    for (size_t i = 0; i < this->spheres.size(); i++) {
-        spheres.push_back((this->spheres[i]));
+    else {
+        InstanceAccelerator *instances = new InstanceAccelerator(options.accelerator, buildOptions);
+        vector<int> meshIndex(this->meshes.size(), -1);
+        for (size_t i = 0; i < this->meshes.size(); i++) {
+            if (!instanced[i]) continue;
+            meshIndex[i] = instances->addMesh(this->meshes[i].faces);
+            instances->addInstance(meshIndex[i], Transform(), this->meshes[i].material_id);
+        }
+        for (size_t i = 0; i < this->mesh_instances.size(); i++) {
+            const MeshInstance &instance = this->mesh_instances[i];
+            instances->addInstance(meshIndex[instance.base_mesh], Transform(instance.transformation), instance.material_id);
+        }
+        accelerator = instances;
+    }
+    {
+        ScopedTimer timer("build acceleration structure");
+        accelerator->build(spheres, faces, background);
+    }
+    build_time_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - buildStart).count();
+    if (!options.quiet) {
+        accelerator->printBuildStats();
     }
-
-
 
     // Ray ray(Vec3f(2, 5, 2), Vec3f(0, -1, 0));
     // Face face(0, 1, 2);
@@ -47,16 +105,82 @@ void Scene::renderScene()
     // std::cout << t << std::endl;
     // return;
 
-    for (size_t i = 0; i < size; i++) {
-        cameras[i]->computeTracingRays();
-        cameras[i]->rayTrace(spheres, faces, background);
+    // tiles of all cameras go through one queue, a camera's image is written by the thread that finishes its last tile
+    vector<int> firstTile(size + 1, 0);
+    for (int i = 0; i < size; i++) {
+        firstTile[i + 1] = firstTile[i] + cameras[i]->tileCount();
     }
-}
+    vector<std::atomic<int> > remainingTiles(size);
+    for (int i = 0; i < size; i++) {
+        remainingTiles[i] = cameras[i]->tileCount();
+    }
+    std::mutex errorMutex;
+    std::string error;
 
-void Scene::saveScene()
-{
-    int size = this->cameras.size();
-    for (size_t i = 0; i < size; i++) {
-        this->cameras[i]->saveImage();
+    for (int i = 0; i < size and options.heatmaps; i++) {
+        cameras[i]->enableHeatmaps();
+    }
+    auto renderStart = std::chrono::high_resolution_clock::now();
+    if (!options.quiet) {
+        std::cout << "Rendering with " << pool.size() << " threads" << std::endl;
+    }
+    if (options.time_budget > 0) {
+        // progressive: coarse passes over all cameras first, each later pass halves the stride. The first pass always completes,
+        // later tiles are skipped after the deadline and keep the upscaled pixels of the previous pass
+        auto deadline = buildStart + std::chrono::duration<double>(options.time_budget);
+        int completeStride = 0; // finest pass that traced all tiles
+        for (int stride = PROGRESSIVE_FIRST_STRIDE; stride >= 1; stride /= 2) {
+            if (stride < PROGRESSIVE_FIRST_STRIDE and std::chrono::high_resolution_clock::now() >= deadline) break;
+            std::atomic<int> skipped(0);
+            pool.run(firstTile[size], [&](int task, int) {
+                if (stride < PROGRESSIVE_FIRST_STRIDE and std::chrono::high_resolution_clock::now() >= deadline) {
+                    skipped ++;
+                    return;
+                }
+                int camera = std::upper_bound(firstTile.begin(), firstTile.end(), task) - firstTile.begin() - 1;
+                cameras[camera]->renderTile(task - firstTile[camera], *accelerator, background, options, stride, stride < PROGRESSIVE_FIRST_STRIDE);
+            });
+            if (!options.quiet and skipped > 0) {
+                std::cout << "Time budget reached: " << skipped << " of " << firstTile[size] << " tiles were not refined to a stride of " << stride << std::endl;
+            }
+            if (skipped > 0) break;
+            completeStride = stride;
+        }
+        if (!options.quiet and completeStride > 1) {
+            std::cout << "Time budget reached: all tiles are complete at a stride of " << completeStride << " pixels" << std::endl;
+        }
+        for (int i = 0; i < size and options.write_images; i++) {
+            try {
+                cameras[i]->saveImage(options);
+            }
+            catch (const std::exception &e) {
+                error = e.what();
+            }
+        }
+    }
+    else {
+        pool.run(firstTile[size], [&](int task, int) {
+            int camera = std::upper_bound(firstTile.begin(), firstTile.end(), task) - firstTile.begin() - 1;
+            cameras[camera]->renderTile(task - firstTile[camera], *accelerator, background, options);
+            if (remainingTiles[camera].fetch_sub(1) == 1 and options.write_images) {
+                try {
+                    cameras[camera]->saveImage(options);
+                }
+                catch (const std::exception &e) {
+                    std::lock_guard<std::mutex> lock(errorMutex);
+                    error = e.what();
+                }
+            }
+        });
+    }
+    render_time_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - renderStart).count();
+    // the workers are idle now, their counters are added up once for the whole render
+    Accelerator::mergeThreadStats();
+    if (!options.quiet) {
+        Accelerator::printTraversalStats(render_time_ms / 1000);
+    }
+    delete accelerator;
+    if (!error.empty()) {
+        throw std::runtime_error(error);
     }
 }
@@ -0,0 +1,381 @@
+#include "../include/Scene.h"
+#include "../include/Profiler.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// bump whenever the layout below or the meaning of a parsed field changes
+#define SCENE_CACHE_VERSION 4
+
+// fixed part at the start of a cache file, followed by the sections in the order they are written in saveCache
+struct SceneCacheHeader
+{
+    char magic[8];                   // "RTSCENE" and a terminating zero
+    unsigned int version;
+    unsigned int endian_check;       // 0x01020304 written in the native byte order
+    unsigned long long source_hash;  // hash of the xml file the cache was compiled from
+};
+
+// read-only view of a file mapped into memory
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::string &path) : data(NULL), size(0)
+    {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        struct stat info;
+        if (fstat(fd, &info) == 0 and info.st_size > 0) {
+            void *mapped = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED) {
+                data = (const char *)mapped;
+                size = info.st_size;
+            }
+        }
+        close(fd);
+    }
+    ~MappedFile()
+    {
+        if (data != NULL) munmap((void *)data, size);
+    }
+    const char *data;
+    size_t size;
+
+private:
+    MappedFile(const MappedFile &);
+    MappedFile &operator=(const MappedFile &);
+};
+
+// reads the sections of a mapped cache file in order, running past the end of the file throws
+class CacheReader
+{
+public:
+    CacheReader(const char *data, size_t size) : p(data), end(data + size) {}
+
+    void bytes(void *out, size_t count)
+    {
+        if ((size_t)(end - p) < count) throw std::runtime_error("Error: The scene cache is truncated.");
+        memcpy(out, p, count);
+        p += count;
+    }
+    template <typename T>
+    void value(T &out) {bytes(&out, sizeof(T));}
+    int count()
+    {
+        int n;
+        value(n);
+        if (n < 0) throw std::runtime_error("Error: The scene cache is corrupt.");
+        return n;
+    }
+    template <typename T>
+    void array(vector<T> &out)
+    {
+        int n = count();
+        out.resize(n);
+        if (n > 0) bytes(&out[0], n * sizeof(T));
+    }
+    std::string text()
+    {
+        int n = count();
+        if ((size_t)(end - p) < (size_t)n) throw std::runtime_error("Error: The scene cache is truncated.");
+        std::string s(p, n);
+        p += n;
+        return s;
+    }
+    bool atEnd() const {return p == end;}
+
+private:
+    const char *p;
+    const char *end;
+};
+
+class CacheWriter
+{
+public:
+    explicit CacheWriter(FILE *output) : ok(true), file(output) {}
+
+    void bytes(const void *data, size_t count)
+    {
+        if (count > 0 and fwrite(data, 1, count, file) != count) ok = false;
+    }
+    template <typename T>
+    void value(const T &data) {bytes(&data, sizeof(T));}
+    template <typename T>
+    void array(const vector<T> &data)
+    {
+        value((int)data.size());
+        if (!data.empty()) bytes(&data[0], data.size() * sizeof(T));
+    }
+    void text(const std::string &s)
+    {
+        value((int)s.size());
+        bytes(s.data(), s.size());
+    }
+    bool ok;
+
+private:
+    FILE *file;
+};
+
+// 64-bit FNV-1a of the whole file, the cache is only used when the xml it was compiled from is unchanged
+static bool hashFile(const std::string &path, unsigned long long &hash)
+{
+    MappedFile file(path);
+    if (file.data == NULL) return false;
+    hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < file.size; i++) {
+        hash = (hash ^ (unsigned char)file.data[i]) * 1099511628211ULL;
+    }
+    return true;
+}
+
+void Scene::loadScene(const std::string &filepath)
+{
+    unsigned long long hash;
+    if (!options.scene_cache or !hashFile(filepath, hash))
+    {
+        parseScene(filepath);
+        return;
+    }
+    std::string cachePath = filepath + ".cache";
+    auto start = std::chrono::high_resolution_clock::now();
+    bool loaded;
+    {
+        ScopedTimer timer("read scene cache");
+        loaded = loadCache(cachePath, hash);
+    }
+    if (loaded)
+    {
+        if (options.verbose)
+        {
+            std::cout << "Loaded " << cachePath << " in " << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count()
+                      << " ms" << std::endl;
+        }
+        return;
+    }
+    parseScene(filepath);
+    ScopedTimer timer("write scene cache");
+    saveCache(cachePath, hash);
+}
+
+bool Scene::loadCache(const std::string &cache_path, unsigned long long source_hash)
+{
+    MappedFile file(cache_path);
+    if (file.data == NULL) return false;
+    try
+    {
+        CacheReader reader(file.data, file.size);
+        SceneCacheHeader header;
+        reader.value(header);
+        if (memcmp(header.magic, "RTSCENE", 8) != 0 or header.version != SCENE_CACHE_VERSION or header.endian_check != 0x01020304
+            or header.source_hash != source_hash)
+        {
+            return false;
+        }
+
+        reader.value(background_color);
+        reader.value(shadow_ray_epsilon);
+        reader.value(max_recursion_depth);
+        reader.value(ambient_light);
+
+        int cameraCount = reader.count();
+        for (int i = 0; i < cameraCount; i++)
+        {
+            Vec3f position, gaze, up;
+            Vec4f near_plane;
+            float near_distance;
+            int image_width, image_height;
+            reader.value(position);
+            reader.value(gaze);
+            reader.value(up);
+            reader.value(near_plane);
+            reader.value(near_distance);
+            reader.value(image_width);
+            reader.value(image_height);
+            std::string image_name = reader.text();
+            std::string ppm_format = reader.text();
+            int num_samples;
+            reader.value(num_samples);
+            if (image_width <= 0 or image_height <= 0 or num_samples < 1) throw std::runtime_error("Error: The scene cache is corrupt.");
+            Camera *camera = new Camera(position, gaze, up, near_plane, near_distance, image_width, image_height, image_name);
+            camera->setPpmFormat(ppm_format);
+            camera->setNumSamples(num_samples);
+            cameras.push_back(camera);
+        }
+
+        reader.array(point_lights);
+        int materialCount = reader.count();
+        materials.resize(materialCount);
+        for (int i = 0; i < materialCount; i++)
+        {
+            unsigned char is_mirror;
+            reader.value(is_mirror);
+            materials[i].is_mirror = is_mirror;
+            reader.value(materials[i].ambient);
+            reader.value(materials[i].diffuse);
+            reader.value(materials[i].specular);
+            reader.value(materials[i].mirror);
+            reader.value(materials[i].phong_exponent);
+        }
+        reader.array(vertex_data);
+
+        int meshCount = reader.count();
+        meshes.resize(meshCount);
+        for (int i = 0; i < meshCount; i++)
+        {
+            reader.value(meshes[i].material_id);
+            reader.array(meshes[i].faces);
+        }
+
+        int triangleCount = reader.count();
+        triangles.resize(triangleCount);
+        for (int i = 0; i < triangleCount; i++)
+        {
+            reader.value(triangles[i].material_id);
+            reader.value(triangles[i].face);
+        }
+
+        int sphereCount = reader.count();
+        spheres.resize(sphereCount);
+        for (int i = 0; i < sphereCount; i++)
+        {
+            reader.value(spheres[i].material_id);
+            reader.value(spheres[i].center_vertex_id);
+            reader.value(spheres[i].radius);
+        }
+
+        int instanceCount = reader.count();
+        mesh_instances.resize(instanceCount);
+        for (int i = 0; i < instanceCount; i++)
+        {
+            reader.value(mesh_instances[i].material_id);
+            reader.value(mesh_instances[i].base_mesh);
+            reader.value(mesh_instances[i].transformation);
+            if (mesh_instances[i].base_mesh < 0 or mesh_instances[i].base_mesh >= meshCount) throw std::runtime_error("Error: The scene cache is corrupt.");
+        }
+        if (!reader.atEnd()) throw std::runtime_error("Error: The scene cache is corrupt.");
+    }
+    catch (const std::exception &)
+    {
+        // a damaged cache is not an error, the scene is parsed again and the cache rewritten
+        clear();
+        return false;
+    }
+    return true;
+}
+
+void Scene::saveCache(const std::string &cache_path, unsigned long long source_hash) const
+{
+    // written under a temporary name and renamed, so a concurrent run never maps a half written cache
+    std::string temporaryPath = cache_path + "." + std::to_string(getpid()) + ".tmp";
+    FILE *file = fopen(temporaryPath.c_str(), "wb");
+    if (file == NULL)
+    {
+        // the cache is only an optimization, a read-only scene directory just means parsing every time
+        if (options.verbose) std::cerr << "Warning: The scene cache " << cache_path << " cannot be written." << std::endl;
+        return;
+    }
+    CacheWriter writer(file);
+    SceneCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "RTSCENE", 8);
+    header.version = SCENE_CACHE_VERSION;
+    header.endian_check = 0x01020304;
+    header.source_hash = source_hash;
+    writer.value(header);
+
+    writer.value(background_color);
+    writer.value(shadow_ray_epsilon);
+    writer.value(max_recursion_depth);
+    writer.value(ambient_light);
+
+    writer.value((int)cameras.size());
+    for (size_t i = 0; i < cameras.size(); i++)
+    {
+        const Camera &camera = *cameras[i];
+        writer.value(camera.position);
+        writer.value(camera.gaze);
+        writer.value(camera.up);
+        writer.value(camera.near_plane);
+        writer.value(camera.near_distance);
+        writer.value(camera.image_width);
+        writer.value(camera.image_height);
+        writer.text(camera.image_name);
+        writer.text(camera.ppm_format);
+        writer.value(camera.num_samples);
+    }
+
+    writer.array(point_lights);
+    // materials are written field by field so that their padding does not end up in the file
+    writer.value((int)materials.size());
+    for (size_t i = 0; i < materials.size(); i++)
+    {
+        writer.value((unsigned char)materials[i].is_mirror);
+        writer.value(materials[i].ambient);
+        writer.value(materials[i].diffuse);
+        writer.value(materials[i].specular);
+        writer.value(materials[i].mirror);
+        writer.value(materials[i].phong_exponent);
+    }
+    writer.array(vertex_data);
+
+    writer.value((int)meshes.size());
+    for (size_t i = 0; i < meshes.size(); i++)
+    {
+        writer.value(meshes[i].material_id);
+        writer.array(meshes[i].faces);
+    }
+
+    writer.value((int)triangles.size());
+    for (size_t i = 0; i < triangles.size(); i++)
+    {
+        writer.value(triangles[i].material_id);
+        writer.value(triangles[i].face);
+    }
+
+    writer.value((int)spheres.size());
+    for (size_t i = 0; i < spheres.size(); i++)
+    {
+        writer.value(spheres[i].material_id);
+        writer.value(spheres[i].center_vertex_id);
+        writer.value(spheres[i].radius);
+    }
+
+    writer.value((int)mesh_instances.size());
+    for (size_t i = 0; i < mesh_instances.size(); i++)
+    {
+        writer.value(mesh_instances[i].material_id);
+        writer.value(mesh_instances[i].base_mesh);
+        writer.value(mesh_instances[i].transformation);
+    }
+
+    bool written = writer.ok;
+    if (fclose(file) != 0) written = false;
+    if (!written or rename(temporaryPath.c_str(), cache_path.c_str()) != 0)
+    {
+        remove(temporaryPath.c_str());
+        if (options.verbose) std::cerr << "Warning: The scene cache " << cache_path << " cannot be written." << std::endl;
+    }
+}
+
+void Scene::clear()
+{
+    for (size_t i = 0; i < cameras.size(); i++)
+    {
+        delete cameras[i];
+    }
+    cameras.clear();
+    point_lights.clear();
+    materials.clear();
+    vertex_data.clear();
+    meshes.clear();
+    triangles.clear();
+    spheres.clear();
+    mesh_instances.clear();
+}
@@ -0,0 +1,93 @@
+#include "../include/ThreadPool.h"
+
+ThreadPool::ThreadPool(int num_threads) : current_task(nullptr), remaining(0), generation(0), stopping(false)
+{
+    if (num_threads <= 0) num_threads = std::thread::hardware_concurrency();
+    if (num_threads <= 0) num_threads = 1;
+    queues = std::vector<WorkerQueue>(num_threads);
+    for (int i = 0; i < num_threads; i ++) {
+        workers.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    work_available.notify_all();
+    for (auto &worker : workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::run(int num_tasks, const std::function<void(int, int)> &task)
+{
+    if (num_tasks <= 0) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        current_task = &task;
+        remaining = num_tasks;
+    }
+    // every worker starts on its own contiguous range, which keeps neighbouring tiles on the same thread
+    int num_workers = queues.size();
+    for (int w = 0; w < num_workers; w ++) {
+        std::lock_guard<std::mutex> lock(queues[w].mutex);
+        for (int i = (long long)num_tasks * w / num_workers; i < (long long)num_tasks * (w + 1) / num_workers; i ++) {
+            queues[w].tasks.push_back(i);
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        generation ++;
+    }
+    work_available.notify_all();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    work_done.wait(lock, [this] {return remaining == 0;});
+}
+
+void ThreadPool::workerLoop(int worker)
+{
+    int seen_generation = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            work_available.wait(lock, [&] {return stopping or generation != seen_generation;});
+            if (stopping) return;
+            seen_generation = generation;
+        }
+        int task;
+        while (popTask(worker, task)) {
+            (*current_task)(task, worker);
+            if (remaining.fetch_sub(1) == 1) {
+                std::lock_guard<std::mutex> lock(mutex);
+                work_done.notify_all();
+            }
+        }
+    }
+}
+
+bool ThreadPool::popTask(int worker, int &task)
+{
+    {
+        std::lock_guard<std::mutex> lock(queues[worker].mutex);
+        if (!queues[worker].tasks.empty()) {
+            task = queues[worker].tasks.front();
+            queues[worker].tasks.pop_front();
+            return true;
+        }
+    }
+    int num_workers = queues.size();
+    for (int i = 1; i < num_workers; i ++) {
+        WorkerQueue &victim = queues[(worker + i) % num_workers];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = victim.tasks.back();
+            victim.tasks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,41 @@
+#include "../include/ToneMap.h"
+#include "../include/basicTypeDefinition.h"
+
+#include <algorithm>
+#include <cmath>
+
+static float luminance(float r, float g, float b)
+{
+    return 0.2126f * r + 0.7152f * g + 0.0722f * b;
+}
+
+void toneMap(const float *hdr, int pixels, const std::string &op, float exposure, unsigned char *ldr)
+{
+    float scale = exp2f(exposure);
+    if (op == "reinhard") {
+        // extended reinhard on the luminance, colors keep their ratios
+        float white = 0;
+        for (int i = 0; i < pixels; i ++) {
+            white = std::max(white, luminance(hdr[3 * i], hdr[3 * i + 1], hdr[3 * i + 2]) * scale / 255.0f);
+        }
+        float white_squared = white > 0 ? white * white : 1;
+        for (int i = 0; i < pixels; i ++) {
+            Vec3f color = Vec3f(hdr[3 * i], hdr[3 * i + 1], hdr[3 * i + 2]) * scale;
+            float l = luminance(color.x, color.y, color.z) / 255.0f;
+            float ratio = l > 0 ? (1 + l / white_squared) / (1 + l) : 0;
+            Vec3i mapped = (color * ratio).clamp();
+            ldr[3 * i] = mapped.x;
+            ldr[3 * i + 1] = mapped.y;
+            ldr[3 * i + 2] = mapped.z;
+        }
+        return;
+    }
+    for (int i = 0; i < pixels; i ++) {
+        Vec3f color(hdr[3 * i], hdr[3 * i + 1], hdr[3 * i + 2]);
+        // without an exposure the channels are rounded exactly as they were traced
+        Vec3i mapped = (exposure == 0 ? color : color * scale).clamp();
+        ldr[3 * i] = mapped.x;
+        ldr[3 * i + 1] = mapped.y;
+        ldr[3 * i + 2] = mapped.z;
+    }
+}
@@ -0,0 +1,82 @@
+#include "../include/Transform.h"
+
+#include <cmath>
+#include <stdexcept>
+
+Transform::Transform()
+{
+    for (int row = 0; row < 4; row ++) {
+        for (int column = 0; column < 4; column ++) m[row][column] = row == column ? 1.0f : 0.0f;
+    }
+}
+
+Transform::Transform(const float *rows)
+{
+    for (int row = 0; row < 4; row ++) {
+        for (int column = 0; column < 4; column ++) m[row][column] = rows[4 * row + column];
+    }
+    if (m[3][0] != 0 or m[3][1] != 0 or m[3][2] != 0 or m[3][3] != 1) {
+        throw std::runtime_error("Error: A transformation must be affine, its last row has to be 0 0 0 1.");
+    }
+}
+
+Transform Transform::inverse() const
+{
+    // gauss-jordan elimination with partial pivoting, in double so that the inverse is accurate to float precision
+    double a[4][8];
+    for (int row = 0; row < 4; row ++) {
+        for (int column = 0; column < 4; column ++) {
+            a[row][column] = m[row][column];
+            a[row][4 + column] = row == column ? 1.0 : 0.0;
+        }
+    }
+    for (int column = 0; column < 4; column ++) {
+        int pivot = column;
+        for (int row = column + 1; row < 4; row ++) {
+            if (fabs(a[row][column]) > fabs(a[pivot][column])) pivot = row;
+        }
+        if (fabs(a[pivot][column]) < 1e-12) throw std::runtime_error("Error: A transformation matrix cannot be inverted.");
+        for (int k = 0; k < 8; k ++) std::swap(a[column][k], a[pivot][k]);
+        double scale = 1.0 / a[column][column];
+        for (int k = 0; k < 8; k ++) a[column][k] *= scale;
+        for (int row = 0; row < 4; row ++) {
+            if (row == column or a[row][column] == 0) continue;
+            double factor = a[row][column];
+            for (int k = 0; k < 8; k ++) a[row][k] -= factor * a[column][k];
+        }
+    }
+    Transform result;
+    for (int row = 0; row < 4; row ++) {
+        for (int column = 0; column < 4; column ++) result.m[row][column] = a[row][4 + column];
+    }
+    return result;
+}
+
+bool Transform::isIdentity() const
+{
+    for (int row = 0; row < 4; row ++) {
+        for (int column = 0; column < 4; column ++) {
+            if (m[row][column] != (row == column ? 1.0f : 0.0f)) return false;
+        }
+    }
+    return true;
+}
+
+Vec3f Transform::point(const Vec3f &p) const
+{
+    return vector(p) + Vec3f(m[0][3], m[1][3], m[2][3]);
+}
+
+Vec3f Transform::vector(const Vec3f &v) const
+{
+    return Vec3f(m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z,
+                 m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z,
+                 m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z);
+}
+
+Vec3f Transform::normal(const Vec3f &n) const
+{
+    return Vec3f(m[0][0] * n.x + m[1][0] * n.y + m[2][0] * n.z,
+                 m[0][1] * n.x + m[1][1] * n.y + m[2][1] * n.z,
+                 m[0][2] * n.x + m[1][2] * n.y + m[2][2] * n.z);
+}
@@ -0,0 +1,111 @@
+#include "../include/Wavefront.h"
+#include "../include/RayPacket.h"
+
+#include <algorithm>
+
+void Wavefront::trace(const vector<Ray> &primary, Accelerator &accelerator, const Background &background, vector<Vec3f> &colors)
+{
+    int count = primary.size();
+    colors.assign(count, Vec3f(0, 0, 0));
+    paths.resize(count);
+    active.clear();
+    // the primary rays are coherent already, they are found in packets
+    for (int first = 0; first < count; first += PACKET_SIZE) {
+        RayPacket packet;
+        int lanes = std::min(PACKET_SIZE, count - first);
+        for (int lane = 0; lane < lanes; lane ++) {
+            Path &path = paths[first + lane];
+            path.ray = primary[first + lane];
+            path.throughput = Vec3f(1, 1, 1);
+            packet.setRay(lane, path.ray.getOrigin(), path.ray.getDirection());
+        }
+        PacketHit hit;
+        accelerator.intersectPacket(packet, hit);
+        for (int lane = 0; lane < lanes; lane ++) {
+            paths[first + lane].primitive = hit.primitive[lane];
+            paths[first + lane].t = hit.t[lane];
+            active.push_back(first + lane);
+        }
+    }
+
+    const vector<PointLight> &lights = background.getPointLights();
+    int num_lights = lights.size();
+    while (!active.empty()) {
+        // misses end their path, only primary rays that miss see the background
+        hits.clear();
+        for (size_t i = 0; i < active.size(); i ++) {
+            Path &path = paths[active[i]];
+            if (path.ray.recordHit(path.primitive, path.t, accelerator, background)) {
+                hits.push_back(active[i]);
+            }
+            else if (path.ray.getDepth() == 0) {
+                colors[active[i]] = Vec3f(background.getBackgroundColor().x, background.getBackgroundColor().y, background.getBackgroundColor().z);
+            }
+        }
+
+        // every shadow ray of the wave is traced before any hit is shaded
+        shadow_queue.clear();
+        for (size_t i = 0; i < hits.size(); i ++) {
+            for (int light = 0; light < num_lights; light ++) {
+                QueuedRay shadow;
+                shadow.path = i;
+                shadow.light = light;
+                paths[hits[i]].ray.shadowRay(lights[light], background, shadow.origin, shadow.direction, shadow.t_max);
+                shadow_queue.push_back(shadow);
+            }
+        }
+        sortQueue(shadow_queue, order);
+        visible.assign(hits.size() * num_lights, 0);
+        for (size_t i = 0; i < order.size(); i ++) {
+            const QueuedRay &shadow = shadow_queue[order[i] & 0xFFFFFFFFu];
+            visible[shadow.path * num_lights + shadow.light] = !Ray::occluded(shadow.origin, shadow.direction, shadow.t_max, accelerator);
+        }
+
+        // the lights are added in the order of Ray::applyShading so that the sums round the same way
+        reflection_queue.clear();
+        for (size_t i = 0; i < hits.size(); i ++) {
+            Path &path = paths[hits[i]];
+            Vec3f shading = background.getAmbientLight() * path.ray.getHitRecord().material->ambient;
+            for (int light = 0; light < num_lights; light ++) {
+                if (visible[i * num_lights + light]) shading = shading + path.ray.lightContribution(lights[light]);
+            }
+            colors[hits[i]] = colors[hits[i]] + shading * path.throughput;
+            if (!path.ray.reflectionWeight(path.throughput, background)) continue;
+            path.ray.reflect(background);
+            Accelerator::threadStats().reflection_rays ++;
+            QueuedRay reflected;
+            reflected.path = hits[i];
+            reflected.light = -1;
+            reflected.origin = path.ray.getOrigin();
+            reflected.direction = path.ray.getDirection();
+            reflected.t_max = INFINITY;
+            reflection_queue.push_back(reflected);
+        }
+
+        sortQueue(reflection_queue, order);
+        active.clear();
+        for (size_t i = 0; i < order.size(); i ++) {
+            const QueuedRay &reflected = reflection_queue[order[i] & 0xFFFFFFFFu];
+            Path &path = paths[reflected.path];
+            path.primitive = accelerator.intersect(reflected.origin, reflected.direction, path.t);
+            active.push_back(reflected.path);
+        }
+    }
+}
+
+void Wavefront::sortQueue(const vector<QueuedRay> &queue, vector<unsigned long long> &order)
+{
+    // the rays stay where they are, only keys with the queue index in the low half are sorted
+    AABB origin_bounds;
+    for (size_t i = 0; i < queue.size(); i ++) {
+        origin_bounds.expand(queue[i].origin);
+    }
+    order.resize(queue.size());
+    for (size_t i = 0; i < queue.size(); i ++) {
+        const QueuedRay &ray = queue[i];
+        unsigned int octant = (ray.direction.x < 0) | (ray.direction.y < 0) << 1 | (ray.direction.z < 0) << 2;
+        unsigned int key = octant << 29 | origin_bounds.mortonCode(ray.origin) >> 1;
+        order[i] = (unsigned long long)key << 32 | i;
+    }
+    std::sort(order.begin(), order.end());
+}
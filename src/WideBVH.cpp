@@ -0,0 +1,214 @@
+#include "../include/WideBVH.h"
+
+#include <chrono>
+#include <iostream>
+
+template <int W>
+void WideBVH<W>::build(vector<Sphere> &spheres, vector<Face> &faces, const Background &background)
+{
+    BVH::build(spheres, faces, background);
+    auto start = std::chrono::high_resolution_clock::now();
+    wide_nodes.clear();
+    wide_leaf_count = 0;
+    binary_node_count = nodes.size();
+    if (!nodes.empty()) {
+        wide_nodes.reserve(nodes.size() / (W / 2) + 1);
+        collapse(0);
+    }
+    vector<BVHNode>().swap(nodes);
+    collapse_time_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+template <int W>
+int WideBVH<W>::collapse(int binary_node)
+{
+    // open the interior child with the largest surface area until the node is full, large children are the most likely to be hit
+    vector<int> children;
+    if (nodes[binary_node].count > 0) {
+        children.push_back(binary_node);
+    }
+    else {
+        children.push_back(binary_node + 1);
+        children.push_back(nodes[binary_node].offset);
+    }
+    while ((int)children.size() < W) {
+        int largest = -1;
+        float largest_area = -1;
+        for (size_t i = 0; i < children.size(); i ++) {
+            const BVHNode &node = nodes[children[i]];
+            if (node.count == 0 and node.bounds.surfaceArea() > largest_area) {
+                largest = i;
+                largest_area = node.bounds.surfaceArea();
+            }
+        }
+        if (largest < 0) break;
+        int opened = children[largest];
+        children[largest] = opened + 1;
+        children.push_back(nodes[opened].offset);
+    }
+
+    int wide_index = wide_nodes.size();
+    wide_nodes.push_back(WideBVHNode<W>());
+    for (int i = 0; i < W; i ++) {
+        WideBVHNode<W> &wide = wide_nodes[wide_index];
+        if (i >= (int)children.size()) {
+            for (int row = 0; row < 6; row ++) wide.bounds[row][i] = INFINITY;
+            wide.child[i] = 0;
+            wide.count[i] = -1;
+            continue;
+        }
+        const BVHNode &node = nodes[children[i]];
+        for (int axis = 0; axis < 3; axis ++) {
+            wide.bounds[axis][i] = node.bounds.min[axis];
+            wide.bounds[3 + axis][i] = node.bounds.max[axis];
+        }
+        if (node.count > 0) {
+            wide.child[i] = node.offset;
+            wide.count[i] = node.count;
+            wide_leaf_count ++;
+        }
+        else {
+            int child = collapse(children[i]); // may move wide_nodes, so the slot is looked up again
+            wide_nodes[wide_index].child[i] = child;
+            wide_nodes[wide_index].count[i] = 0;
+        }
+    }
+    return wide_index;
+}
+
+// lane by lane the operations of AABB::intersect, four children at a time
+template <int W>
+static int intersectChildGroups(const WideBVHNode<W> &node, const Vec3f4 &origin, const Vec3f4 &inv_direction, float t_max, float *t_near)
+{
+    int hits = 0;
+    for (int group = 0; group < W; group += 4) {
+        Float4 t0(0.0f), t1(t_max * 1.0000004f);
+        for (int axis = 0; axis < 3; axis ++) {
+            Float4 t_min_axis = (Float4::load(node.bounds[axis] + group) - origin[axis]) * inv_direction[axis];
+            Float4 t_max_axis = (Float4::load(node.bounds[3 + axis] + group) - origin[axis]) * inv_direction[axis];
+            Mask4 swap = t_min_axis > t_max_axis;
+            Float4 t_entry = select(swap, t_max_axis, t_min_axis);
+            Float4 t_exit = select(swap, t_min_axis, t_max_axis) * Float4(1.0000004f);
+            t0 = select(t_entry > t0, t_entry, t0);
+            t1 = select(t_exit < t1, t_exit, t1);
+        }
+        t0.store(t_near + group);
+        hits |= (t0 <= t1).bits() << group;
+    }
+    return hits;
+}
+
+template <int W>
+int WideBVH<W>::intersectChildren(const WideBVHNode<W> &node, const Vec3f &, const Vec3f &, const Vec3f4 &origin4, const Vec3f4 &inv_direction4,
+                                  float t_max, float *t_near) const
+{
+    return intersectChildGroups(node, origin4, inv_direction4, t_max, t_near);
+}
+
+// with the AVX2 kernels the eight children of a node are tested at once, the same operations give the same distances
+template <>
+int WideBVH<8>::intersectChildren(const WideBVHNode<8> &node, const Vec3f &origin, const Vec3f &inv_direction, const Vec3f4 &origin4,
+                                  const Vec3f4 &inv_direction4, float t_max, float *t_near) const
+{
+#if defined(__x86_64__) or defined(__i386__)
+    if (kernels->width == 8) return intersectBoxesAvx2(node.bounds, &origin.x, &inv_direction.x, t_max, t_near);
+#endif
+    return intersectChildGroups(node, origin4, inv_direction4, t_max, t_near);
+}
+
+template <int W>
+int WideBVH<W>::intersect(const Vec3f &origin, const Vec3f &direction, float &t, float t_max) const
+{
+    TraversalStats &stats = threadStats();
+    stats.rays ++;
+    t = t_max;
+    if (wide_nodes.empty()) return -1;
+
+    Vec3f inv_direction(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+    Vec3f4 origin4(origin.x, origin.y, origin.z), inv_direction4(inv_direction.x, inv_direction.y, inv_direction.z);
+
+    // entries keep the distance at which they were hit, a closer hit found since then can skip them
+    struct Entry
+    {
+        int child;
+        int count;
+        float t_near;
+    };
+    Entry stack[64 * W];
+    int stack_size = 0;
+    stack[stack_size ++] = {0, 0, 0.0f};
+    int hit = -1;
+    while (stack_size > 0) {
+        Entry entry = stack[-- stack_size];
+        if (entry.t_near > t * 1.0000004f) continue;
+        if (entry.count > 0) {
+            for (int i = entry.child; i < entry.child + entry.count; i ++) {
+                (blocks[i].is_sphere ? stats.sphere_tests : stats.triangle_tests) += blocks[i].count;
+                kernels->intersect(blocks[i], &origin.x, &direction.x, t, hit);
+            }
+            continue;
+        }
+        const WideBVHNode<W> &node = wide_nodes[entry.child];
+        stats.nodes_visited ++;
+        alignas(16) float t_near[W];
+        int hits = intersectChildren(node, origin, inv_direction, origin4, inv_direction4, t, t_near);
+        // the children that are hit are pushed far to near, so the nearest one is visited first
+        int first = stack_size;
+        for (int i = 0; i < W; i ++) {
+            if (!(hits & (1 << i)) or node.count[i] < 0) continue;
+            Entry child = {node.child[i], node.count[i], t_near[i]};
+            int j = stack_size ++;
+            while (j > first and stack[j - 1].t_near < child.t_near) {
+                stack[j] = stack[j - 1];
+                j --;
+            }
+            stack[j] = child;
+        }
+    }
+    return hit;
+}
+
+template <int W>
+bool WideBVH<W>::occluded(const Vec3f &origin, const Vec3f &direction, float t_max) const
+{
+    TraversalStats &stats = threadStats();
+    stats.rays ++;
+    if (wide_nodes.empty()) return false;
+
+    Vec3f inv_direction(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+    Vec3f4 origin4(origin.x, origin.y, origin.z), inv_direction4(inv_direction.x, inv_direction.y, inv_direction.z);
+
+    // any hit terminates the query, so the children are not ordered
+    int stack[64 * W];
+    int stack_size = 0;
+    stack[stack_size ++] = 0;
+    while (stack_size > 0) {
+        const WideBVHNode<W> &node = wide_nodes[stack[-- stack_size]];
+        stats.nodes_visited ++;
+        alignas(16) float t_near[W];
+        int hits = intersectChildren(node, origin, inv_direction, origin4, inv_direction4, t_max, t_near);
+        for (int i = 0; i < W; i ++) {
+            if (!(hits & (1 << i)) or node.count[i] < 0) continue;
+            if (node.count[i] == 0) {
+                stack[stack_size ++] = node.child[i];
+                continue;
+            }
+            for (int b = node.child[i]; b < node.child[i] + node.count[i]; b ++) {
+                (blocks[b].is_sphere ? stats.sphere_tests : stats.triangle_tests) += blocks[b].count;
+                if (kernels->occluded(blocks[b], &origin.x, &direction.x, t_max)) return true;
+            }
+        }
+    }
+    return false;
+}
+
+template <int W>
+void WideBVH<W>::printBuildStats() const
+{
+    std::cout << "BVH" << W << ": " << primitiveCount() << " primitives, " << wide_nodes.size() << " nodes collapsed from " << binary_node_count
+              << " binary nodes, " << wide_leaf_count << " leaves in " << blocks.size() << " " << kernels->name << " blocks, SAH cost " << sah_cost
+              << " before collapsing, built with " << builderName() << " in " << build_time_ms + collapse_time_ms << " ms" << std::endl;
+}
+
+template class WideBVH<4>;
+template class WideBVH<8>;
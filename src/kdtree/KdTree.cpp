@@ -0,0 +1,134 @@
+#include "../../include/KdTree.h"
+#include "../../include/Ray.h"
+
+#include <iostream>
+
+struct KdToDo
+{
+    int node;
+    float t_min, t_max;
+};
+
+int KdTree::intersect(const Vec3f &origin, const Vec3f &direction, float &t, float t_max) const
+{
+    TraversalStats &stats = threadStats();
+    stats.rays ++;
+    t = t_max;
+    if (nodes.empty()) return -1;
+
+    Vec3f inv_direction(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+    float t_min, t_far;
+    if (!bounds.intersect(origin, inv_direction, t_max, t_min, t_far)) return -1;
+
+    int hit = -1;
+    KdToDo stack[64];
+    int stack_size = 0;
+    int node_index = 0;
+    while (true) {
+        // every remaining node starts behind the closest hit found so far
+        if (t < t_min) break;
+        const KdNode &node = nodes[node_index];
+        stats.nodes_visited ++;
+        if (!node.isLeaf()) {
+            int axis = node.axis();
+            float t_plane = (node.split - origin[axis]) * inv_direction[axis];
+            bool below_first = origin[axis] < node.split or (origin[axis] == node.split and direction[axis] <= 0);
+            int first = below_first ? node_index + 1 : node.aboveChild();
+            int second = below_first ? node.aboveChild() : node_index + 1;
+
+            if (t_plane > t_far or t_plane <= 0) {
+                node_index = first;
+            }
+            else if (t_plane < t_min) {
+                node_index = second;
+            }
+            else { // the ray crosses the plane inside the node, postpone the far child
+                stack[stack_size].node = second;
+                stack[stack_size].t_min = t_plane;
+                stack[stack_size].t_max = t_far;
+                stack_size ++;
+                node_index = first;
+                t_far = t_plane;
+            }
+        }
+        else {
+            const int *leaf_primitives = primitive_indices.data() + node.primitive_offset;
+            for (int i = 0; i < node.primitiveCount(); i ++) {
+                int primitive = leaf_primitives[i];
+                float t_primitive = intersectPrimitive(origin, direction, primitive);
+                if (closerHit(t_primitive, primitive, t, hit)) {
+                    t = t_primitive;
+                    hit = primitive;
+                }
+            }
+            if (stack_size == 0) break;
+            stack_size --;
+            node_index = stack[stack_size].node;
+            t_min = stack[stack_size].t_min;
+            t_far = stack[stack_size].t_max;
+        }
+    }
+    return hit;
+}
+
+bool KdTree::occluded(const Vec3f &origin, const Vec3f &direction, float t_max) const
+{
+    TraversalStats &stats = threadStats();
+    stats.rays ++;
+    if (nodes.empty()) return false;
+
+    Vec3f inv_direction(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+    float t_min, t_far;
+    if (!bounds.intersect(origin, inv_direction, t_max, t_min, t_far)) return false;
+
+    KdToDo stack[64];
+    int stack_size = 0;
+    int node_index = 0;
+    while (true) {
+        const KdNode &node = nodes[node_index];
+        stats.nodes_visited ++;
+        if (!node.isLeaf()) {
+            int axis = node.axis();
+            float t_plane = (node.split - origin[axis]) * inv_direction[axis];
+            bool below_first = origin[axis] < node.split or (origin[axis] == node.split and direction[axis] <= 0);
+            int first = below_first ? node_index + 1 : node.aboveChild();
+            int second = below_first ? node.aboveChild() : node_index + 1;
+
+            if (t_plane > t_far or t_plane <= 0) {
+                node_index = first;
+            }
+            else if (t_plane < t_min) {
+                node_index = second;
+            }
+            else {
+                stack[stack_size].node = second;
+                stack[stack_size].t_min = t_plane;
+                stack[stack_size].t_max = t_far;
+                stack_size ++;
+                node_index = first;
+                t_far = t_plane;
+            }
+        }
+        else {
+            const int *leaf_primitives = primitive_indices.data() + node.primitive_offset;
+            for (int i = 0; i < node.primitiveCount(); i ++) {
+                float t_primitive = intersectPrimitive(origin, direction, leaf_primitives[i]);
+                if (t_primitive > 0 and t_primitive < t_max) return true;
+            }
+            if (stack_size == 0) break;
+            stack_size --;
+            node_index = stack[stack_size].node;
+            t_min = stack[stack_size].t_min;
+            t_far = stack[stack_size].t_max;
+        }
+    }
+    return false;
+}
+
+void KdTree::printBuildStats() const
+{
+    int references = primitive_indices.size();
+    std::cout << "kd-tree: " << primitiveCount() << " primitives, " << nodes.size() << " nodes, " << leaf_count
+              << " leaves (" << empty_leaf_count << " empty), " << (leaf_count > 0 ? (float)references / leaf_count : 0)
+              << " primitives per leaf, depth " << max_depth << ", built in " << build_time_ms << " ms" << std::endl;
+}
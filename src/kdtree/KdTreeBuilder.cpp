@@ -0,0 +1,195 @@
+#include "../../include/KdTree.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+#define TRAVERSAL_COST 1.0f
+#define INTERSECTION_COST 80.0f
+#define EMPTY_BONUS 0.5f
+#define MAX_LEAF_SIZE 1
+
+void KdTree::build(vector<Sphere> &spheres, vector<Face> &faces, const Background &background)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    precomputePrimitives(spheres, faces, background);
+    nodes.clear();
+    primitive_indices.clear();
+    bounds = AABB();
+    max_depth = leaf_count = empty_leaf_count = 0;
+
+    vector<AABB> primitive_bounds;
+    computePrimitiveBounds(primitive_bounds);
+    vector<int> primitives(primitive_bounds.size());
+    for (size_t i = 0; i < primitive_bounds.size(); i ++) {
+        bounds.expand(primitive_bounds[i]);
+        primitives[i] = i;
+    }
+
+    if (!primitives.empty()) {
+        depth_limit = std::min(60, (int)round(8 + 1.3f * log2((float)primitives.size())));
+        buildRecursive(primitive_bounds, bounds, primitives, depth_limit, 0);
+    }
+    build_time_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void KdTree::makeLeaf(int node_index, vector<int> &primitives)
+{
+    nodes[node_index].primitive_offset = primitive_indices.size();
+    nodes[node_index].flags = 3 | ((int)primitives.size() << 2);
+    primitive_indices.insert(primitive_indices.end(), primitives.begin(), primitives.end());
+    leaf_count ++;
+    if (primitives.empty()) empty_leaf_count ++;
+}
+
+void KdTree::buildRecursive(vector<AABB> &primitive_bounds, const AABB &node_bounds,
+                            vector<int> &primitives, int depth, int bad_refines)
+{
+    int node_index = nodes.size();
+    nodes.push_back(KdNode());
+    max_depth = std::max(max_depth, depth_limit - depth);
+
+    int count = primitives.size();
+    if (count <= MAX_LEAF_SIZE or depth == 0) {
+        makeLeaf(node_index, primitives);
+        return;
+    }
+
+    // split clipping: events are generated from the part of each primitive inside this node instead of its full bounds
+    vector<AABB> clipped(count);
+    vector<int> inside;
+    inside.reserve(count);
+    for (int i = 0; i < count; i ++) {
+        AABB box = node_index == 0 ? primitive_bounds[primitives[i]]
+                                   : clipPrimitive(primitive_bounds, primitives[i], node_bounds);
+        if (box.min.x > box.max.x or box.min.y > box.max.y or box.min.z > box.max.z) continue;
+        clipped[inside.size()] = box;
+        inside.push_back(primitives[i]);
+    }
+    count = inside.size();
+    clipped.resize(count);
+    if (count <= MAX_LEAF_SIZE) {
+        makeLeaf(node_index, inside);
+        return;
+    }
+
+    float total_area = node_bounds.surfaceArea();
+    float inv_total_area = total_area > 0 ? 1.0f / total_area : 0;
+    Vec3f extent = node_bounds.max - node_bounds.min;
+    float old_cost = INTERSECTION_COST * count;
+    float best_cost = INFINITY;
+    int best_axis = -1, best_offset = -1;
+    vector<KdEvent> events[3];
+
+    // try the longest axis first and only fall back to the others if it offers no split
+    int axis = extent.x > extent.y and extent.x > extent.z ? 0 : (extent.y > extent.z ? 1 : 2);
+    for (int retries = 0; retries < 3 and best_axis == -1; retries ++, axis = (axis + 1) % 3) {
+        vector<KdEvent> &axis_events = events[axis];
+        axis_events.resize(2 * count);
+        for (int i = 0; i < count; i ++) {
+            axis_events[2 * i].position = clipped[i].min[axis];
+            axis_events[2 * i].primitive = i;
+            axis_events[2 * i].start = true;
+            axis_events[2 * i + 1].position = clipped[i].max[axis];
+            axis_events[2 * i + 1].primitive = i;
+            axis_events[2 * i + 1].start = false;
+        }
+        std::sort(axis_events.begin(), axis_events.end());
+
+        int other_axis0 = (axis + 1) % 3, other_axis1 = (axis + 2) % 3;
+        int below = 0, above = count;
+        for (int i = 0; i < 2 * count; i ++) {
+            if (!axis_events[i].start) above --;
+            float split = axis_events[i].position;
+            if (split > node_bounds.min[axis] and split < node_bounds.max[axis]) {
+                float below_area = 2 * (extent[other_axis0] * extent[other_axis1] +
+                                        (split - node_bounds.min[axis]) * (extent[other_axis0] + extent[other_axis1]));
+                float above_area = 2 * (extent[other_axis0] * extent[other_axis1] +
+                                        (node_bounds.max[axis] - split) * (extent[other_axis0] + extent[other_axis1]));
+                float bonus = (below == 0 or above == 0) ? EMPTY_BONUS : 0;
+                float cost = TRAVERSAL_COST + INTERSECTION_COST * (1 - bonus) *
+                             (below_area * inv_total_area * below + above_area * inv_total_area * above);
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_offset = i;
+                }
+            }
+            if (axis_events[i].start) below ++;
+        }
+    }
+
+    if (best_cost > old_cost) bad_refines ++;
+    if ((best_cost > 4 * old_cost and count < 16) or best_axis == -1 or bad_refines == 3) {
+        makeLeaf(node_index, inside);
+        return;
+    }
+
+    vector<int> below_primitives, above_primitives;
+    vector<KdEvent> &best_events = events[best_axis];
+    for (int i = 0; i < best_offset; i ++) {
+        if (best_events[i].start) below_primitives.push_back(inside[best_events[i].primitive]);
+    }
+    for (int i = best_offset + 1; i < 2 * count; i ++) {
+        if (!best_events[i].start) above_primitives.push_back(inside[best_events[i].primitive]);
+    }
+    float split = best_events[best_offset].position;
+    // release the per node arrays before descending
+    for (int i = 0; i < 3; i ++) vector<KdEvent>().swap(events[i]);
+    vector<AABB>().swap(clipped);
+    vector<int>().swap(inside);
+    AABB below_bounds = node_bounds, above_bounds = node_bounds;
+    below_bounds.max[best_axis] = split;
+    above_bounds.min[best_axis] = split;
+
+    buildRecursive(primitive_bounds, below_bounds, below_primitives, depth - 1, bad_refines);
+    int above_child = nodes.size();
+    buildRecursive(primitive_bounds, above_bounds, above_primitives, depth - 1, bad_refines);
+    nodes[node_index].split = split;
+    nodes[node_index].flags = best_axis | (above_child << 2);
+}
+
+AABB KdTree::clipPrimitive(vector<AABB> &primitive_bounds, int primitive, const AABB &node_bounds) const
+{
+    AABB overlap = primitive_bounds[primitive].intersection(node_bounds);
+    if (isSphere(primitive) or overlap.min.x > overlap.max.x or overlap.min.y > overlap.max.y or overlap.min.z > overlap.max.z) {
+        return overlap;
+    }
+
+    // Sutherland-Hodgman clipping of the triangle against the six planes of the node
+    const TriangleRecord &triangle = getTriangle(primitive);
+    Vec3f polygon[2][9];
+    polygon[0][0] = triangle.v0;
+    polygon[0][1] = triangle.v0 + triangle.edge1;
+    polygon[0][2] = triangle.v0 + triangle.edge2;
+    int size = 3, current = 0;
+    for (int axis = 0; axis < 3 and size > 0; axis ++) {
+        for (int side = 0; side < 2 and size > 0; side ++) {
+            float plane = side == 0 ? node_bounds.min[axis] : node_bounds.max[axis];
+            Vec3f *in = polygon[current], *out = polygon[1 - current];
+            int out_size = 0;
+            for (int i = 0; i < size; i ++) {
+                const Vec3f &a = in[i], &b = in[(i + 1) % size];
+                bool a_inside = side == 0 ? a[axis] >= plane : a[axis] <= plane;
+                bool b_inside = side == 0 ? b[axis] >= plane : b[axis] <= plane;
+                if (a_inside) out[out_size ++] = a;
+                if (a_inside != b_inside and out_size < 9) {
+                    Vec3f p = a + (b - a) * ((plane - a[axis]) / (b[axis] - a[axis]));
+                    p[axis] = plane;
+                    out[out_size ++] = p;
+                }
+            }
+            size = out_size;
+            current = 1 - current;
+        }
+    }
+    // the clipped polygon can vanish through rounding for triangles that only graze the node
+    if (size == 0) return overlap;
+
+    // the clipped bounds are widened by a small margin so that rounding in the clipping never loses a part of the triangle
+    AABB clipped;
+    for (int i = 0; i < size; i ++) clipped.expand(polygon[current][i]);
+    Vec3f margin = (node_bounds.max - node_bounds.min) * 1e-5f;
+    clipped = AABB(clipped.min - margin, clipped.max + margin);
+    return clipped.intersection(overlap);
+}
@@ -1,17 +1,158 @@
 #include <iostream>
+#include <cstdlib>
+#include <cstring>
 #include "../include/basicTypeDefinition.h"
 #include "../include/Ray.h"
 #include "../include/Camera.h"
 #include "../include/Scene.h"
+#include "../include/Benchmark.h"
+#include "../include/Profiler.h"
 
 
 using namespace std;
 
+static void printUsage(const char *program)
+{
+    cerr << "Usage: " << program << " [options] <input_scene>.xml" << endl
+         << "       " << program << " [options] --benchmark <scene_directory> [--repeat <n>] [--json <file>]" << endl
+         << "Options:" << endl
+         << "  --accel <bvh|bvh4|bvh8|kdtree>  acceleration structure used for all ray queries (default: bvh)" << endl
+         << "  --builder <sah|lbvh>  BVH construction: binned SAH splits or the faster morton code splits (default: sah)" << endl
+         << "  --treelets            refine the BVH by restructuring treelets for a lower SAH cost" << endl
+         << "  --sampling <uniform|adaptive> trace all NumSamples samples of every pixel, or 4 first and the rest only where" << endl
+         << "                        they or neighbouring pixels differ by more than the threshold (default: uniform)" << endl
+         << "  --adaptive-threshold <x> luminance difference in 0-255 that makes a pixel get all samples (default: 8)" << endl
+         << "  --min-throughput <x>  stop following mirror reflections once their weight is at most x in every channel (default: 0)" << endl
+         << "  --time-budget <s>     render progressively, from every 8th pixel to all of them, and write the best image reached" << endl
+         << "                        after s seconds of building and rendering (the first coarse pass always completes)" << endl
+         << "  --threads <n>         number of render threads (default: one per hardware thread)" << endl
+         << "  --ppm <P6|P3>         output format of cameras without a PpmFormat element (default: P6)" << endl
+         << "  --tonemap <clamp|reinhard> how the float image becomes the ppm: clamped channels, or luminance compressed so" << endl
+         << "                        that the brightest pixel is white (default: clamp)" << endl
+         << "  --exposure <stops>    scales the image by 2^stops before tone mapping (default: 0)" << endl
+         << "  --pfm                 also write the float image of every camera, before tone mapping, as <image>.pfm" << endl
+         << "  --heatmaps            also write <image>_nodes, _primitives, _shadow and _depth.ppm with the cost of every pixel" << endl
+         << "                        in false colors, its rays are then traced one by one" << endl
+         << "  --trace <packet|single|wavefront> trace primary rays in packets of neighbouring pixels, one by one, or every kind" << endl
+         << "                        of ray of a tile together from sorted queues (default: packet)" << endl
+         << "  --simd <auto|avx2|sse> intersection kernels for the BVH leaves, auto picks AVX2 when the processor has it" << endl
+         << "  --no-cache            always parse the xml instead of reusing or writing <scene>.xml.cache" << endl
+         << "  --verbose             print how long each part of the scene file takes to load" << endl
+         << "  --quiet               do not print the build and traversal statistics" << endl
+         << "  --benchmark <dir>     render every scene in the directory without writing images and report timings as JSON" << endl
+         << "  --repeat <n>          number of runs per benchmark scene, min and median are reported (default: 3)" << endl
+         << "  --json <file>         write the benchmark report to a file instead of the standard output" << endl
+         << "  --profile <file>      write the time of every phase, tile and thread as a Chrome trace (chrome://tracing, Perfetto)" << endl;
+}
+
 int main(int argc, char *argv[])
 {
-    Scene scene;
-    scene.loadScene(argv[1]);
-    scene.renderScene();
-    scene.saveScene();
+    RenderOptions options;
+    const char *scene_file = nullptr;
+    const char *benchmark_directory = nullptr;
+    const char *json_file = "";
+    const char *profile_file = nullptr;
+    int repeats = 3;
+    for (int i = 1; i < argc; i ++) {
+        if (strcmp(argv[i], "--accel") == 0 and i + 1 < argc
+            and (strcmp(argv[i + 1], "bvh") == 0 or strcmp(argv[i + 1], "bvh4") == 0 or strcmp(argv[i + 1], "bvh8") == 0 or strcmp(argv[i + 1], "kdtree") == 0)) {
+            options.accelerator = argv[++ i];
+        }
+        else if (strcmp(argv[i], "--builder") == 0 and i + 1 < argc and (strcmp(argv[i + 1], "sah") == 0 or strcmp(argv[i + 1], "lbvh") == 0)) {
+            options.builder = argv[++ i];
+        }
+        else if (strcmp(argv[i], "--treelets") == 0) {
+            options.treelets = true;
+        }
+        else if (strcmp(argv[i], "--sampling") == 0 and i + 1 < argc and (strcmp(argv[i + 1], "uniform") == 0 or strcmp(argv[i + 1], "adaptive") == 0)) {
+            options.sampling = argv[++ i];
+        }
+        else if (strcmp(argv[i], "--adaptive-threshold") == 0 and i + 1 < argc) {
+            options.adaptive_threshold = atof(argv[++ i]);
+        }
+        else if (strcmp(argv[i], "--min-throughput") == 0 and i + 1 < argc) {
+            options.min_throughput = atof(argv[++ i]);
+        }
+        else if (strcmp(argv[i], "--time-budget") == 0 and i + 1 < argc and atof(argv[i + 1]) > 0) {
+            options.time_budget = atof(argv[++ i]);
+        }
+        else if (strcmp(argv[i], "--threads") == 0 and i + 1 < argc) {
+            options.threads = atoi(argv[++ i]);
+        }
+        else if (strcmp(argv[i], "--ppm") == 0 and i + 1 < argc and (strcmp(argv[i + 1], "P3") == 0 or strcmp(argv[i + 1], "P6") == 0)) {
+            options.ppm_format = argv[++ i];
+        }
+        else if (strcmp(argv[i], "--tonemap") == 0 and i + 1 < argc and (strcmp(argv[i + 1], "clamp") == 0 or strcmp(argv[i + 1], "reinhard") == 0)) {
+            options.tone_map = argv[++ i];
+        }
+        else if (strcmp(argv[i], "--exposure") == 0 and i + 1 < argc) {
+            options.exposure = atof(argv[++ i]);
+        }
+        else if (strcmp(argv[i], "--pfm") == 0) {
+            options.write_pfm = true;
+        }
+        else if (strcmp(argv[i], "--heatmaps") == 0) {
+            options.heatmaps = true;
+        }
+        else if (strcmp(argv[i], "--trace") == 0 and i + 1 < argc
+                 and (strcmp(argv[i + 1], "packet") == 0 or strcmp(argv[i + 1], "single") == 0 or strcmp(argv[i + 1], "wavefront") == 0)) {
+            options.trace = argv[++ i];
+        }
+        else if (strcmp(argv[i], "--simd") == 0 and i + 1 < argc
+                 and (strcmp(argv[i + 1], "auto") == 0 or strcmp(argv[i + 1], "avx2") == 0 or strcmp(argv[i + 1], "sse") == 0)) {
+            options.simd = argv[++ i];
+        }
+        else if (strcmp(argv[i], "--no-cache") == 0) {
+            options.scene_cache = false;
+        }
+        else if (strcmp(argv[i], "--verbose") == 0) {
+            options.verbose = true;
+        }
+        else if (strcmp(argv[i], "--quiet") == 0) {
+            options.quiet = true;
+        }
+        else if (strcmp(argv[i], "--benchmark") == 0 and i + 1 < argc) {
+            benchmark_directory = argv[++ i];
+        }
+        else if (strcmp(argv[i], "--repeat") == 0 and i + 1 < argc and atoi(argv[i + 1]) > 0) {
+            repeats = atoi(argv[++ i]);
+        }
+        else if (strcmp(argv[i], "--json") == 0 and i + 1 < argc) {
+            json_file = argv[++ i];
+        }
+        else if (strcmp(argv[i], "--profile") == 0 and i + 1 < argc) {
+            profile_file = argv[++ i];
+        }
+        else if (argv[i][0] != '-' and scene_file == nullptr) {
+            scene_file = argv[i];
+        }
+        else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (benchmark_directory == nullptr and scene_file == nullptr) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    if (profile_file != nullptr) {
+        Profiler::enable();
+    }
+    if (benchmark_directory != nullptr) {
+        runBenchmark(options, benchmark_directory, repeats, json_file);
+    }
+    else {
+        Scene scene;
+        scene.setOptions(options);
+        {
+            ScopedTimer timer("load scene");
+            scene.loadScene(scene_file);
+        }
+        ScopedTimer timer("render scene");
+        scene.renderScene();
+    }
+    if (profile_file != nullptr) {
+        Profiler::write(profile_file);
+    }
     return 0;
-}
\ No newline at end of file
+}
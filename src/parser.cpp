@@ -1,9 +1,164 @@
 #include "../include/Scene.h"
+#include "../include/Profiler.h"
+#include "../include/Transform.h"
 
-void Scene::loadScene(const std::string &filepath)
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+
+// reads whitespace separated numbers directly from the text of an xml element, without copying it into a stream
+class NumberReader
+{
+public:
+    explicit NumberReader(const char *text) : p(text ? text : "") {}
+
+    bool next(float &value)
+    {
+        skipSpace();
+        if (*p == '\0') return false;
+        const char *start = p;
+        bool negative = (*p == '-');
+        if (*p == '-' or *p == '+') p++;
+        // the significant digits are collected as an integer, leading zeros do not count
+        unsigned long long mantissa = 0;
+        int digits = 0, exponent = 0;
+        bool any_digit = false;
+        while (isDigit(*p)) {
+            if (mantissa != 0 or *p != '0') {
+                if (digits < 19) {mantissa = mantissa * 10 + (*p - '0'); digits++;}
+                else exponent++;
+            }
+            p++;
+            any_digit = true;
+        }
+        if (*p == '.') {
+            p++;
+            while (isDigit(*p)) {
+                if (digits < 19) {
+                    if (mantissa != 0 or *p != '0') {mantissa = mantissa * 10 + (*p - '0'); digits++;}
+                    exponent--;
+                }
+                p++;
+                any_digit = true;
+            }
+        }
+        if (!any_digit) throw std::runtime_error("Error: Invalid number in the xml file.");
+        if (*p == 'e' or *p == 'E') {
+            const char *e = p + 1;
+            bool negative_exponent = (*e == '-');
+            if (*e == '-' or *e == '+') e++;
+            if (isDigit(*e)) {
+                int power = 0;
+                while (isDigit(*e)) {if (power < 10000) power = power * 10 + (*e - '0'); e++;}
+                exponent += negative_exponent ? -power : power;
+                p = e;
+            }
+        }
+        if (!isSpace(*p) and *p != '\0') throw std::runtime_error("Error: Invalid number in the xml file.");
+
+        // the mantissa and the power of ten are both exact in a double, so only the division or product is rounded before the cast
+        if (digits <= 15 and exponent >= -22 and exponent <= 22) {
+            double result = (double)mantissa;
+            result = exponent < 0 ? result / powerOfTen(-exponent) : result * powerOfTen(exponent);
+            value = (float)(negative ? -result : result);
+        }
+        else {
+            value = strtof(start, NULL);
+        }
+        return true;
+    }
+
+    bool next(int &value)
+    {
+        skipSpace();
+        if (*p == '\0') return false;
+        bool negative = (*p == '-');
+        if (*p == '-' or *p == '+') p++;
+        if (!isDigit(*p)) throw std::runtime_error("Error: Invalid integer in the xml file.");
+        int result = 0;
+        while (isDigit(*p)) result = result * 10 + (*p++ - '0');
+        if (!isSpace(*p) and *p != '\0') throw std::runtime_error("Error: Invalid integer in the xml file.");
+        value = negative ? -result : result;
+        return true;
+    }
+
+    template <typename T>
+    void read(T &value)
+    {
+        if (!next(value)) throw std::runtime_error("Error: A number is missing in the xml file.");
+    }
+
+    template <typename T>
+    void read(T &x, T &y, T &z)
+    {
+        read(x);
+        read(y);
+        read(z);
+    }
+
+    // the next whitespace separated token
+    std::string word()
+    {
+        skipSpace();
+        const char *start = p;
+        while (*p != '\0' and !isSpace(*p)) p++;
+        return std::string(start, p);
+    }
+
+    // number of tokens that are left, used to size the vertex and face vectors before they are filled
+    size_t countTokens() const
+    {
+        size_t count = 0;
+        const char *q = p;
+        while (true) {
+            while (isSpace(*q)) q++;
+            if (*q == '\0') return count;
+            count++;
+            while (*q != '\0' and !isSpace(*q)) q++;
+        }
+    }
+
+private:
+    const char *p;
+
+    static bool isDigit(char c) {return c >= '0' and c <= '9';}
+    static bool isSpace(char c) {return c == ' ' or c == '\t' or c == '\n' or c == '\r' or c == '\v' or c == '\f';}
+    void skipSpace() {while (isSpace(*p)) p++;}
+    static double powerOfTen(int exponent)
+    {
+        static const double powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+        return powers[exponent];
+    }
+};
+
+// text of a child element that every scene has to define
+static const char *childText(const tinyxml2::XMLElement *element, const char *name)
 {
+    const tinyxml2::XMLElement *child = element->FirstChildElement(name);
+    if (!child)
+    {
+        throw std::runtime_error(std::string("Error: ") + name + " is not found in " + element->Name() + ".");
+    }
+    return child->GetText();
+}
+
+void Scene::parseScene(const std::string &filepath)
+{
+    ScopedTimer timer("parse scene");
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point start = Clock::now(), phaseStart = start;
+    // milliseconds since the previous call, for the load time breakdown, the phase is also a slice of the profile
+    auto lap = [&](const char *phase) {
+        Clock::time_point now = Clock::now();
+        double ms = std::chrono::duration<double, std::milli>(now - phaseStart).count();
+        if (Profiler::isEnabled()) Profiler::record(phase, NULL, 0, phaseStart, now);
+        phaseStart = now;
+        return ms;
+    };
+
     tinyxml2::XMLDocument file;
-    std::stringstream stream;
 
     auto res = file.LoadFile(filepath.c_str());
     if (res)
@@ -16,97 +171,88 @@ void Scene::loadScene(const std::string &filepath)
     {
         throw std::runtime_error("Error: Root is not found.");
     }
+    double xmlTime = lap("parse xml");
 
     // Get BackgroundColor
     auto element = root->FirstChildElement("BackgroundColor");
+    background_color = Vec3i(0, 0, 0);
     if (element)
     {
-        stream << element->GetText() << std::endl;
+        NumberReader(element->GetText()).read(background_color.x, background_color.y, background_color.z);
     }
-    else
-    {
-        stream << "0 0 0" << std::endl;
-    }
-    stream >> background_color.x >> background_color.y >> background_color.z;
 
     // Get ShadowRayEpsilon
     element = root->FirstChildElement("ShadowRayEpsilon");
+    shadow_ray_epsilon = 0.001;
     if (element)
     {
-        stream << element->GetText() << std::endl;
+        NumberReader(element->GetText()).read(shadow_ray_epsilon);
     }
-    else
-    {
-        stream << "0.001" << std::endl;
-    }
-    stream >> shadow_ray_epsilon;
 
     // Get MaxRecursionDepth
     element = root->FirstChildElement("MaxRecursionDepth");
+    max_recursion_depth = 0;
     if (element)
     {
-        stream << element->GetText() << std::endl;
-    }
-    else
-    {
-        stream << "0" << std::endl;
+        NumberReader(element->GetText()).read(max_recursion_depth);
     }
-    stream >> max_recursion_depth;
 
     // Get Cameras
     element = root->FirstChildElement("Cameras");
     element = element->FirstChildElement("Camera");
-    // Camera camera;
-    float x, y, z, w, gaze_x, gaze_y, gaze_z, up_x, up_y, up_z;
+    Vec3f position, gaze, up;
     float near_x, near_y, near_z, near_w, near_distance;
     int image_width, image_height;
     std::string image_name;
     while (element)
     {
-        auto child = element->FirstChildElement("Position");
-        stream << child->GetText() << std::endl;
-        child = element->FirstChildElement("Gaze");
-        stream << child->GetText() << std::endl;
-        child = element->FirstChildElement("Up");
-        stream << child->GetText() << std::endl;
-        child = element->FirstChildElement("NearPlane");
-        stream << child->GetText() << std::endl;
-        child = element->FirstChildElement("NearDistance");
-        stream << child->GetText() << std::endl;
-        child = element->FirstChildElement("ImageResolution");
-        stream << child->GetText() << std::endl;
-        child = element->FirstChildElement("ImageName");
-        stream << child->GetText() << std::endl;
-
-        stream >> x >> y >> z;
-        stream >> gaze_x >> gaze_y >> gaze_z;
-        stream >> up_x >> up_y >> up_z;
-        stream >> near_x >> near_y >> near_z >> near_w;
-        stream >> near_distance;
-        stream >> image_width >> image_height;
-        stream >> image_name;
-        Camera* camera = new Camera(Vec3f(x, y, z), Vec3f(gaze_x, gaze_y, gaze_z), Vec3f(up_x, up_y, up_z),
-                        Vec4f(near_x, near_y, near_z, near_w), near_distance, image_width, image_height, image_name);
+        NumberReader(childText(element, "Position")).read(position.x, position.y, position.z);
+        NumberReader(childText(element, "Gaze")).read(gaze.x, gaze.y, gaze.z);
+        NumberReader(childText(element, "Up")).read(up.x, up.y, up.z);
+        NumberReader nearPlane(childText(element, "NearPlane"));
+        nearPlane.read(near_x, near_y, near_z);
+        nearPlane.read(near_w);
+        NumberReader(childText(element, "NearDistance")).read(near_distance);
+        NumberReader resolution(childText(element, "ImageResolution"));
+        resolution.read(image_width);
+        resolution.read(image_height);
+        image_name = NumberReader(childText(element, "ImageName")).word();
+
+        Camera* camera = new Camera(position, gaze, up, Vec4f(near_x, near_y, near_z, near_w), near_distance, image_width, image_height, image_name);
         cameras.push_back(camera);
+        auto child = element->FirstChildElement("PpmFormat");
+        if (child)
+        {
+            std::string ppm_format = NumberReader(child->GetText()).word();
+            if (ppm_format != "P3" and ppm_format != "P6")
+            {
+                throw std::runtime_error("Error: PpmFormat must be P3 or P6.");
+            }
+            camera->setPpmFormat(ppm_format);
+        }
+        child = element->FirstChildElement("NumSamples");
+        if (child)
+        {
+            int num_samples;
+            NumberReader(child->GetText()).read(num_samples);
+            if (num_samples < 1)
+            {
+                throw std::runtime_error("Error: NumSamples must be at least 1.");
+            }
+            camera->setNumSamples(num_samples);
+        }
         element = element->NextSiblingElement("Camera");
     }
 
     // Get Lights
     element = root->FirstChildElement("Lights");
-    auto child = element->FirstChildElement("AmbientLight");
-    stream << child->GetText() << std::endl;
-    stream >> ambient_light.x >> ambient_light.y >> ambient_light.z;
+    NumberReader(childText(element, "AmbientLight")).read(ambient_light.x, ambient_light.y, ambient_light.z);
     element = element->FirstChildElement("PointLight");
     PointLight point_light;
     while (element)
     {
-        child = element->FirstChildElement("Position");
-        stream << child->GetText() << std::endl;
-        child = element->FirstChildElement("Intensity");
-        stream << child->GetText() << std::endl;
-
-        stream >> point_light.position.x >> point_light.position.y >> point_light.position.z;
-        stream >> point_light.intensity.x >> point_light.intensity.y >> point_light.intensity.z;
+        NumberReader(childText(element, "Position")).read(point_light.position.x, point_light.position.y, point_light.position.z);
+        NumberReader(childText(element, "Intensity")).read(point_light.intensity.x, point_light.intensity.y, point_light.intensity.z);
 
         point_lights.push_back(point_light);
         element = element->NextSiblingElement("PointLight");
@@ -115,7 +261,6 @@ void Scene::loadScene(const std::string &filepath)
     // Get Materials
     element = root->FirstChildElement("Materials");
     element = element->FirstChildElement("Material");
-    Material material;
     bool is_mirror;
     Vec3f ambient, diffuse, specular, mirror;
     float phong_exponent;
@@ -123,63 +268,54 @@ void Scene::loadScene(const std::string &filepath)
     {
         is_mirror = (element->Attribute("type", "mirror") != NULL);
 
-        child = element->FirstChildElement("AmbientReflectance");
-        stream << child->GetText() << std::endl;
-        child = element->FirstChildElement("DiffuseReflectance");
-        stream << child->GetText() << std::endl;
-        child = element->FirstChildElement("SpecularReflectance");
-        stream << child->GetText() << std::endl;
-        child = element->FirstChildElement("MirrorReflectance");
-        stream << child->GetText() << std::endl;
-        child = element->FirstChildElement("PhongExponent");
-        stream << child->GetText() << std::endl;
-
-        stream >> ambient.x >> ambient.y >> ambient.z;
-        stream >> diffuse.x >> diffuse.y >> diffuse.z;
-        stream >> specular.x >> specular.y >> specular.z;
-        stream >> mirror.x >> mirror.y >> mirror.z;
-        stream >> phong_exponent;
-        material = Material(is_mirror, ambient, diffuse, specular, mirror, phong_exponent);
-        materials.push_back(material);
+        NumberReader(childText(element, "AmbientReflectance")).read(ambient.x, ambient.y, ambient.z);
+        NumberReader(childText(element, "DiffuseReflectance")).read(diffuse.x, diffuse.y, diffuse.z);
+        NumberReader(childText(element, "SpecularReflectance")).read(specular.x, specular.y, specular.z);
+        NumberReader(childText(element, "MirrorReflectance")).read(mirror.x, mirror.y, mirror.z);
+        NumberReader(childText(element, "PhongExponent")).read(phong_exponent);
+        materials.push_back(Material(is_mirror, ambient, diffuse, specular, mirror, phong_exponent));
         element = element->NextSiblingElement("Material");
     }
-    
+    double settingsTime = lap("read cameras, lights and materials");
+
     // Get VertexData
     element = root->FirstChildElement("VertexData");
-    stream << element->GetText() << std::endl;
+    NumberReader vertices(element ? element->GetText() : NULL);
+    vertex_data.reserve(vertex_data.size() + vertices.countTokens() / 3);
     Vec3f vertex;
-    while (!(stream >> vertex.x).eof())
+    while (vertices.next(vertex.x))
     {
-        stream >> vertex.y >> vertex.z;
+        vertices.read(vertex.y);
+        vertices.read(vertex.z);
         vertex_data.push_back(vertex);
     }
-    stream.clear();
+    double vertexTime = lap("read vertices");
 
     // Get Meshes
     element = root->FirstChildElement("Objects");
     element = element->FirstChildElement("Mesh");
-    Mesh mesh;
+    size_t faceCount = 0;
+    std::map<int, int> meshIndex; // id attribute to position in meshes
     while (element)
     {
-        child = element->FirstChildElement("Material");
-        stream << child->GetText() << std::endl;
-        stream >> mesh.material_id;
+        meshIndex[element->IntAttribute("id")] = meshes.size();
+        meshes.push_back(Mesh());
+        Mesh &mesh = meshes.back();
+        NumberReader(childText(element, "Material")).read(mesh.material_id);
 
-        child = element->FirstChildElement("Faces");
-        stream << child->GetText() << std::endl;
+        NumberReader faces(childText(element, "Faces"));
+        mesh.faces.reserve(faces.countTokens() / 3);
         Face face;
-        while (!(stream >> face.v0_id).eof())
+        while (faces.next(face.v0_id))
         {
-            stream >> face.v1_id >> face.v2_id;
+            faces.read(face.v1_id);
+            faces.read(face.v2_id);
             mesh.faces.push_back(face);
         }
-        stream.clear();
-
-        meshes.push_back(mesh);
-        mesh.faces.clear();
+        faceCount += mesh.faces.size();
         element = element->NextSiblingElement("Mesh");
     }
-    stream.clear();
+    double meshTime = lap("read meshes");
 
     // Get Triangles
     element = root->FirstChildElement("Objects");
@@ -187,13 +323,8 @@ void Scene::loadScene(const std::string &filepath)
     Triangle triangle;
     while (element)
     {
-        child = element->FirstChildElement("Material");
-        stream << child->GetText() << std::endl;
-        stream >> triangle.material_id;
-
-        child = element->FirstChildElement("Indices");
-        stream << child->GetText() << std::endl;
-        stream >> triangle.face.v0_id >> triangle.face.v1_id >> triangle.face.v2_id;
+        NumberReader(childText(element, "Material")).read(triangle.material_id);
+        NumberReader(childText(element, "Indices")).read(triangle.face.v0_id, triangle.face.v1_id, triangle.face.v2_id);
 
         triangles.push_back(triangle);
         element = element->NextSiblingElement("Triangle");
@@ -205,19 +336,58 @@ void Scene::loadScene(const std::string &filepath)
     Sphere sphere;
     while (element)
     {
-        child = element->FirstChildElement("Material");
-        stream << child->GetText() << std::endl;
-        stream >> sphere.material_id;
-
-        child = element->FirstChildElement("Center");
-        stream << child->GetText() << std::endl;
-        stream >> sphere.center_vertex_id;
-
-        child = element->FirstChildElement("Radius");
-        stream << child->GetText() << std::endl;
-        stream >> sphere.radius;
+        NumberReader(childText(element, "Material")).read(sphere.material_id);
+        NumberReader(childText(element, "Center")).read(sphere.center_vertex_id);
+        NumberReader(childText(element, "Radius")).read(sphere.radius);
 
         spheres.push_back(sphere);
         element = element->NextSiblingElement("Sphere");
     }
+
+    // Get MeshInstances, the material defaults to the base mesh's and the transformation to the identity
+    element = root->FirstChildElement("Objects");
+    element = element->FirstChildElement("MeshInstance");
+    while (element)
+    {
+        MeshInstance instance;
+        std::map<int, int>::const_iterator base = meshIndex.find(element->IntAttribute("baseMeshId"));
+        if (base == meshIndex.end())
+        {
+            throw std::runtime_error("Error: A MeshInstance refers to a mesh that does not exist.");
+        }
+        instance.base_mesh = base->second;
+        instance.material_id = meshes[instance.base_mesh].material_id;
+        if (element->FirstChildElement("Material"))
+        {
+            NumberReader(childText(element, "Material")).read(instance.material_id);
+        }
+        Transform identity;
+        for (int i = 0; i < 16; i++)
+        {
+            instance.transformation[i] = identity.m[i / 4][i % 4];
+        }
+        if (element->FirstChildElement("Transformation"))
+        {
+            NumberReader transformation(childText(element, "Transformation"));
+            for (int i = 0; i < 16; i++)
+            {
+                transformation.read(instance.transformation[i]);
+            }
+            Transform(instance.transformation).inverse(); // rejects matrices that are not affine or cannot be inverted
+        }
+        mesh_instances.push_back(instance);
+        element = element->NextSiblingElement("MeshInstance");
+    }
+    double objectTime = lap("read triangles, spheres and instances");
+
+    if (options.verbose)
+    {
+        std::cout << "Loaded " << filepath << " in " << std::chrono::duration<double, std::milli>(phaseStart - start).count() << " ms" << std::endl
+                  << "  xml: " << xmlTime << " ms" << std::endl
+                  << "  cameras, lights, materials: " << settingsTime << " ms" << std::endl
+                  << "  vertices (" << vertex_data.size() << "): " << vertexTime << " ms" << std::endl
+                  << "  meshes (" << meshes.size() << ", " << faceCount << " faces): " << meshTime << " ms" << std::endl
+                  << "  triangles (" << triangles.size() << "), spheres (" << spheres.size() << ") and mesh instances (" << mesh_instances.size()
+                  << "): " << objectTime << " ms" << std::endl;
+    }
 }
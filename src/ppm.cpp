@@ -1,15 +1,32 @@
 #include "../include/ppm.h"
+#include <cstdio>
+#include <cstring>
 #include <stdexcept>
+#include <vector>
 
-void write_ppm(const char* filename, unsigned char* data, int width, int height)
+void write_ppm(const char* filename, unsigned char* data, int width, int height, bool binary)
 {
     FILE *outfile;
 
-    if ((outfile = fopen(filename, "w")) == NULL) 
+    if ((outfile = fopen(filename, binary ? "wb" : "w")) == NULL) 
     {
         throw std::runtime_error("Error: The ppm file cannot be opened for writing.");
     }
 
+    if (binary)
+    {
+        // the image data is already laid out as P6 expects, so the pixels go out in a single write
+        (void) fprintf(outfile, "P6\n%d %d\n255\n", width, height);
+        size_t size = (size_t)width * height * 3;
+        if (fwrite(data, 1, size, outfile) != size)
+        {
+            (void) fclose(outfile);
+            throw std::runtime_error("Error: The ppm file cannot be written.");
+        }
+        (void) fclose(outfile);
+        return;
+    }
+
     (void) fprintf(outfile, "P3\n%d %d\n255\n", width, height);
 
     unsigned char color;
@@ -37,3 +54,37 @@ void write_ppm(const char* filename, unsigned char* data, int width, int height)
 
     (void) fclose(outfile);
 }
+
+void write_pfm(const char* filename, const float* data, int width, int height)
+{
+    FILE *outfile;
+
+    if ((outfile = fopen(filename, "wb")) == NULL)
+    {
+        throw std::runtime_error("Error: The pfm file cannot be opened for writing.");
+    }
+
+    // a negative scale marks little endian floats, they are written byte by byte so the host order does not matter
+    (void) fprintf(outfile, "PF\n%d %d\n-1.0\n", width, height);
+    std::vector<unsigned char> row((size_t)width * 3 * 4);
+    for (int j = height - 1; j >= 0; --j)
+    {
+        const float *pixels = data + (size_t)j * width * 3;
+        for (size_t k = 0; k < (size_t)width * 3; ++k)
+        {
+            unsigned int bits;
+            memcpy(&bits, pixels + k, 4);
+            row[4 * k] = bits & 0xFF;
+            row[4 * k + 1] = (bits >> 8) & 0xFF;
+            row[4 * k + 2] = (bits >> 16) & 0xFF;
+            row[4 * k + 3] = bits >> 24;
+        }
+        if (fwrite(row.data(), 1, row.size(), outfile) != row.size())
+        {
+            (void) fclose(outfile);
+            throw std::runtime_error("Error: The pfm file cannot be written.");
+        }
+    }
+
+    (void) fclose(outfile);
+}